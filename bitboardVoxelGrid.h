@@ -0,0 +1,313 @@
+#ifndef BITBOARD_VOXEL_GRID_H
+#define BITBOARD_VOXEL_GRID_H
+
+#include "voxelGrid.h"
+#include <vector>
+#include <random>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//Occupancy-only grid packing 64 cells along z into each word, with a falling-sand kernel that updates a whole word of
+//cells per operation. Implements the grid interface from voxelGrid.h, but stores no velocity or material: at() returns a
+//water cell with zero velocity, so use this layout with the random rule.
+//
+//stepRandom() processes y layers bottom up. In each layer every voxel with an empty cell below falls, then the rest
+//spread: each voxel draws one of the four cyclic direction orders of updateVoxelMatrixRandom (+x -x +z -z starting at
+//a random entry) from two random mask words, and four passes try every voxel's first, second, third and fourth choice.
+//Moves within a pass have distinct sources and distinct free targets, so they are applied directly with shifts and
+//masks; voxels that have moved are dropped from the pending mask so nothing moves twice in a step.
+
+class BitboardVoxelGrid
+{
+public:
+	const int sizeX;
+	const int sizeY;
+	const int sizeZ;
+
+	BitboardVoxelGrid(int x, int y, int z) : sizeX(x), sizeY(y), sizeZ(z)
+	{
+		wordsPerRow = (z + 63) / 64;
+		bits.assign((size_t)x * y * wordsPerRow, 0);
+		pending.assign((size_t)x * wordsPerRow, 0);
+		choiceLow.assign((size_t)x * wordsPerRow, 0);
+		choiceHigh.assign((size_t)x * wordsPerRow, 0);
+		freeCells.assign(wordsPerRow, 0);
+		shifted.assign(wordsPerRow, 0);
+		moved.assign(wordsPerRow, 0);
+		targets.assign(wordsPerRow, 0);
+
+		validMask.assign(wordsPerRow, ~(uint64_t)0);
+		if (z % 64 != 0)
+			validMask[wordsPerRow - 1] = ((uint64_t)1 << (z % 64)) - 1;
+
+		std::random_device rd;
+		rngState = ((uint64_t)rd() << 32) | rd() | 1;
+	}
+
+	bool containsVoxel(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return false;
+		return (row(x, y)[z >> 6] >> (z & 63)) & 1;
+	}
+
+	voxelPosition& at(int x, int y, int z)
+	{
+		scratch = voxelPosition();
+		scratch.containsVoxel = containsVoxel(x, y, z);
+		scratch.material = materialAt(x, y, z);
+		return scratch;
+	}
+
+	uint8_t materialAt(int x, int y, int z) const
+	{
+		return containsVoxel(x, y, z) ? (uint8_t)MATERIAL_WATER : (uint8_t)MATERIAL_EMPTY;
+	}
+
+	void placeVoxel(int x, int y, int z, glm::vec3 = glm::vec3(0.0f), uint8_t = MATERIAL_WATER)
+	{
+		row(x, y)[z >> 6] |= (uint64_t)1 << (z & 63);
+	}
+
+	void removeVoxel(int x, int y, int z)
+	{
+		row(x, y)[z >> 6] &= ~((uint64_t)1 << (z & 63));
+	}
+
+	template <typename F>
+	void sweep(F f)
+	{
+		for (int i = 0; i < sizeX; i++)
+			for (int j = 0; j < sizeY; j++)
+				for (int w = 0; w < wordsPerRow; w++)
+				{
+					uint64_t word = row(i, j)[w];
+					while (word)
+					{
+						int k = w * 64 + countTrailingZeros(word);
+						word &= word - 1;
+						if (containsVoxel(i, j, k))
+							f(i, j, k);
+					}
+				}
+	}
+
+	template <typename F>
+	void forEachVoxel(F f) const
+	{
+		voxelPosition cell;
+		cell.containsVoxel = true;
+		cell.material = MATERIAL_WATER;
+		for (int i = 0; i < sizeX; i++)
+			for (int j = 0; j < sizeY; j++)
+				for (int w = 0; w < wordsPerRow; w++)
+				{
+					uint64_t word = row(i, j)[w];
+					while (word)
+					{
+						f(i, j, w * 64 + countTrailingZeros(word), cell);
+						word &= word - 1;
+					}
+				}
+	}
+
+	size_t memoryBytes() const
+	{
+		return (bits.size() + pending.size() * 3) * sizeof(uint64_t);
+	}
+
+	//Restarts stepRandom()'s generator from a fixed value, for reproducible runs
+	void seed(uint64_t value)
+	{
+		rngState = (value + 0x9E3779B97F4A7C15ull) * 0xBF58476D1CE4E5B9ull | 1;
+	}
+
+	//One step of the random rule over the whole grid
+	void stepRandom()
+	{
+		const int W = wordsPerRow;
+
+		for (int y = 0; y < sizeY; y++)
+		{
+			//Fall
+			if (y > 0)
+			{
+				for (int x = 0; x < sizeX; x++)
+				{
+					uint64_t* current = row(x, y);
+					uint64_t* below = row(x, y - 1);
+					for (int w = 0; w < W; w++)
+					{
+						uint64_t falling = current[w] & ~below[w];
+						below[w] |= falling;
+						current[w] &= ~falling;
+					}
+				}
+			}
+
+			//Everything left in the layer tries to spread
+			uint64_t layerOccupied = 0;
+			for (int x = 0; x < sizeX; x++)
+			{
+				for (int w = 0; w < W; w++)
+				{
+					uint64_t word = row(x, y)[w];
+					pending[x * W + w] = word;
+					layerOccupied |= word;
+					if (word)
+					{
+						choiceLow[x * W + w] = nextRandom();
+						choiceHigh[x * W + w] = nextRandom();
+					}
+				}
+			}
+			if (!layerOccupied)
+				continue;
+
+			for (int pass = 0; pass < 4; pass++)
+			{
+				for (int direction = 0; direction < 4; direction++)
+				{
+					//Voxels whose order starts at entry c try entry (c + pass) & 3 in this pass
+					int choice = (direction - pass) & 3;
+					for (int x = 0; x < sizeX; x++)
+						moveRow(x, y, direction, choice);
+				}
+			}
+		}
+	}
+
+	static int countTrailingZeros(uint64_t word)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return (int)index;
+#else
+		return __builtin_ctzll(word);
+#endif
+	}
+
+private:
+	int wordsPerRow;
+	std::vector<uint64_t> bits;
+	std::vector<uint64_t> validMask;
+	uint64_t rngState;
+	voxelPosition scratch;
+
+	//Per-layer and per-row scratch, kept between steps to avoid allocating
+	std::vector<uint64_t> pending;
+	std::vector<uint64_t> choiceLow;
+	std::vector<uint64_t> choiceHigh;
+	std::vector<uint64_t> freeCells;
+	std::vector<uint64_t> shifted;
+	std::vector<uint64_t> moved;
+	std::vector<uint64_t> targets;
+
+	uint64_t* row(int x, int y) { return &bits[((size_t)x * sizeY + y) * wordsPerRow]; }
+	const uint64_t* row(int x, int y) const { return &bits[((size_t)x * sizeY + y) * wordsPerRow]; }
+
+	//xorshift64*
+	uint64_t nextRandom()
+	{
+		rngState ^= rngState >> 12;
+		rngState ^= rngState << 25;
+		rngState ^= rngState >> 27;
+		return rngState * 0x2545F4914F6CDD1Dull;
+	}
+
+	uint64_t choiceMask(int index, int choice) const
+	{
+		uint64_t low = choice & 1 ? choiceLow[index] : ~choiceLow[index];
+		uint64_t high = choice & 2 ? choiceHigh[index] : ~choiceHigh[index];
+		return low & high;
+	}
+
+	//out bit k = in bit k - 1, carrying across words
+	static void shiftTowardHigh(const std::vector<uint64_t>& in, std::vector<uint64_t>& out, int W)
+	{
+		uint64_t carry = 0;
+		for (int w = 0; w < W; w++)
+		{
+			out[w] = (in[w] << 1) | carry;
+			carry = in[w] >> 63;
+		}
+	}
+
+	//out bit k = in bit k + 1, carrying across words
+	static void shiftTowardLow(const std::vector<uint64_t>& in, std::vector<uint64_t>& out, int W)
+	{
+		uint64_t carry = 0;
+		for (int w = W - 1; w >= 0; w--)
+		{
+			out[w] = (in[w] >> 1) | carry;
+			carry = in[w] << 63;
+		}
+	}
+
+	//direction: 0 = +x, 1 = -x, 2 = +z, 3 = -z
+	void moveRow(int x, int y, int direction, int choice)
+	{
+		const int W = wordsPerRow;
+		uint64_t* current = row(x, y);
+		uint64_t* rowPending = &pending[x * W];
+
+		uint64_t anyPending = 0;
+		for (int w = 0; w < W; w++)
+			anyPending |= rowPending[w];
+		if (!anyPending)
+			return;
+
+		if (direction < 2)
+		{
+			int targetX = direction == 0 ? x + 1 : x - 1;
+			if (targetX < 0 || targetX >= sizeX)
+				return;
+			uint64_t* target = row(targetX, y);
+			for (int w = 0; w < W; w++)
+			{
+				uint64_t m = rowPending[w] & choiceMask(x * W + w, choice) & ~target[w];
+				target[w] |= m;
+				current[w] &= ~m;
+				rowPending[w] &= ~m;
+			}
+			return;
+		}
+
+		for (int w = 0; w < W; w++)
+			freeCells[w] = ~current[w] & validMask[w];
+
+		//Movers need a free cell one step along the direction; their targets are the movers shifted the same way
+		if (direction == 2)
+			shiftTowardLow(freeCells, shifted, W);
+		else
+			shiftTowardHigh(freeCells, shifted, W);
+
+		bool any = false;
+		for (int w = 0; w < W; w++)
+		{
+			moved[w] = rowPending[w] & choiceMask(x * W + w, choice) & shifted[w];
+			any |= moved[w] != 0;
+		}
+		if (!any)
+			return;
+
+		if (direction == 2)
+			shiftTowardHigh(moved, targets, W);
+		else
+			shiftTowardLow(moved, targets, W);
+
+		for (int w = 0; w < W; w++)
+		{
+			current[w] = (current[w] & ~moved[w]) | targets[w];
+			rowPending[w] &= ~moved[w];
+		}
+	}
+};
+
+template <>
+struct concurrentReads<BitboardVoxelGrid> { enum { value = 1 }; };
+
+#endif
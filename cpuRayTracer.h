@@ -0,0 +1,216 @@
+#ifndef CPU_RAY_TRACER_H
+#define CPU_RAY_TRACER_H
+
+#include "voxelGrid.h"
+#include "jobSystem.h"
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+//Renders the occupancy grid on the CPU for machines without a GPU. Uses the same scheme as volumeRayMarch.frag: cell c is
+//the box [c - 0.5, c + 0.5] * voxelSpacing, rays are clipped to the grid and walked with a DDA over BLOCK^3 blocks, and
+//the per-cell DDA only runs inside occupied blocks. Hits are lit by one directional light with a shadow ray traced the
+//same way. The image is cut into TILE x TILE tiles that run as separate jobs, so idle workers steal the slow ones.
+
+class CpuRayTracer
+{
+public:
+	enum { BLOCK = 8, TILE = 32 };
+
+	CpuRayTracer(int x, int y, int z, float spacing) : sizeX(x), sizeY(y), sizeZ(z), voxelSpacing(spacing)
+	{
+		blocksX = (x + BLOCK - 1) / BLOCK;
+		blocksY = (y + BLOCK - 1) / BLOCK;
+		blocksZ = (z + BLOCK - 1) / BLOCK;
+		cells.assign((size_t)x * y * z, 0);
+		blocks.assign((size_t)blocksX * blocksY * blocksZ, 0);
+		lightDirection = glm::normalize(glm::vec3(0.4f, 1.0f, 0.25f));
+	}
+
+	//Copies the grid's occupancy
+	template <typename Grid>
+	void upload(const Grid& grid)
+	{
+		std::fill(cells.begin(), cells.end(), 0);
+		std::fill(blocks.begin(), blocks.end(), 0);
+		grid.forEachVoxel([&](int x, int y, int z, const voxelPosition&)
+		{
+			cells[cellIndex(x, y, z)] = 1;
+			blocks[((size_t)(z / BLOCK) * blocksY + y / BLOCK) * blocksX + x / BLOCK] = 1;
+		});
+	}
+
+	//Renders into rgb (width * height * 3 bytes, top row first) from eye looking at target
+	void render(glm::vec3 eye, glm::vec3 target, float fovYDegrees, int width, int height, JobSystem& jobs, std::vector<uint8_t>& rgb) const
+	{
+		rgb.resize((size_t)width * height * 3);
+
+		glm::vec3 forward = glm::normalize(target - eye);
+		glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+		glm::vec3 up = glm::cross(right, forward);
+		float halfHeight = std::tan(glm::radians(fovYDegrees) / 2.0f);
+		float halfWidth = halfHeight * width / height;
+
+		int tilesX = (width + TILE - 1) / TILE;
+		int tilesY = (height + TILE - 1) / TILE;
+		jobs.parallelFor(0, tilesX * tilesY, 1, [&](int firstTile, int lastTile, int)
+		{
+			for (int tile = firstTile; tile < lastTile; tile++)
+			{
+				int x0 = (tile % tilesX) * TILE, y0 = (tile / tilesX) * TILE;
+				for (int py = y0; py < std::min(y0 + TILE, height); py++)
+				{
+					for (int px = x0; px < std::min(x0 + TILE, width); px++)
+					{
+						float sx = (2.0f * (px + 0.5f) / width - 1.0f) * halfWidth;
+						float sy = (1.0f - 2.0f * (py + 0.5f) / height) * halfHeight;
+						glm::vec3 direction = glm::normalize(forward + right * sx + up * sy);
+						glm::vec3 colour = shade(eye, direction);
+
+						uint8_t* pixel = &rgb[((size_t)py * width + px) * 3];
+						pixel[0] = (uint8_t)(std::min(colour.x, 1.0f) * 255.0f + 0.5f);
+						pixel[1] = (uint8_t)(std::min(colour.y, 1.0f) * 255.0f + 0.5f);
+						pixel[2] = (uint8_t)(std::min(colour.z, 1.0f) * 255.0f + 0.5f);
+					}
+				}
+			}
+		});
+	}
+
+private:
+	int sizeX, sizeY, sizeZ;
+	int blocksX, blocksY, blocksZ;
+	float voxelSpacing;
+	glm::vec3 lightDirection;
+	std::vector<uint8_t> cells;
+	std::vector<uint8_t> blocks;
+
+	struct rayHit
+	{
+		float t;
+		int cell[3];
+	};
+
+	//x fastest, like the volume renderer's texture
+	size_t cellIndex(int x, int y, int z) const { return ((size_t)z * sizeY + y) * sizeX + x; }
+
+	glm::vec3 shade(glm::vec3 eye, glm::vec3 direction) const
+	{
+		const glm::vec3 background(0.2f, 0.3f, 0.3f);
+		const glm::vec3 fluid(0.25f, 0.55f, 0.9f);
+
+		rayHit hit;
+		if (!trace(eye, direction, hit))
+			return background;
+
+		//The face the ray entered through is the one the hit point lies closest to
+		glm::vec3 point = eye + direction * hit.t;
+		glm::vec3 local = point / voxelSpacing + glm::vec3(0.5f);
+		glm::vec3 normal(0.0f);
+		float closest = 2.0f;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float low = local[axis] - hit.cell[axis], high = hit.cell[axis] + 1 - local[axis];
+			if (low < closest) { closest = low; normal = glm::vec3(0.0f); normal[axis] = -1.0f; }
+			if (high < closest) { closest = high; normal = glm::vec3(0.0f); normal[axis] = 1.0f; }
+		}
+
+		float diffuse = std::max(glm::dot(normal, lightDirection), 0.0f);
+		rayHit blocker;
+		if (diffuse > 0.0f && trace(point + normal * (0.01f * voxelSpacing), lightDirection, blocker))
+			diffuse = 0.0f;
+		return fluid * (0.3f + 0.7f * diffuse);
+	}
+
+	//First occupied cell along the ray, with the world distance at which it is entered
+	bool trace(glm::vec3 eye, glm::vec3 rayDirection, rayHit& hit) const
+	{
+		const float epsilon = 1e-4f;
+		float origin[3], direction[3], invDirection[3];
+		int stepDir[3];
+		int size[3] = { sizeX, sizeY, sizeZ };
+		int blockCount[3] = { blocksX, blocksY, blocksZ };
+
+		//Cell space: cell c spans [c, c + 1]
+		float tEnter = 0.0f, tExit = 1e30f;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float d = rayDirection[axis];
+			if (d == 0.0f)
+				d = 1e-7f;
+			origin[axis] = eye[axis] / voxelSpacing + 0.5f;
+			direction[axis] = d / voxelSpacing;
+			invDirection[axis] = 1.0f / direction[axis];
+			stepDir[axis] = direction[axis] > 0 ? 1 : -1;
+
+			float tLow = -origin[axis] * invDirection[axis];
+			float tHigh = (size[axis] - origin[axis]) * invDirection[axis];
+			tEnter = std::max(tEnter, std::min(tLow, tHigh));
+			tExit = std::min(tExit, std::max(tLow, tHigh));
+		}
+		if (tEnter >= tExit)
+			return false;
+
+		int block[3];
+		float tNext[3], tDelta[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float p = origin[axis] + direction[axis] * (tEnter + epsilon);
+			block[axis] = std::min(std::max((int)std::floor(p / BLOCK), 0), blockCount[axis] - 1);
+			tNext[axis] = ((block[axis] + (stepDir[axis] > 0)) * (float)BLOCK - origin[axis]) * invDirection[axis];
+			tDelta[axis] = std::fabs(BLOCK * invDirection[axis]);
+		}
+
+		float tBlock = tEnter;
+		while (tBlock < tExit)
+		{
+			int axis = tNext[0] <= tNext[1] && tNext[0] <= tNext[2] ? 0 : (tNext[1] <= tNext[2] ? 1 : 2);
+			float tBlockExit = std::min(tNext[axis], tExit);
+			if (blocks[((size_t)block[2] * blocksY + block[1]) * blocksX + block[0]] &&
+				traceCells(origin, direction, invDirection, stepDir, tBlock, tBlockExit, hit))
+				return true;
+
+			tBlock = tBlockExit;
+			block[axis] += stepDir[axis];
+			tNext[axis] += tDelta[axis];
+			if (block[axis] < 0 || block[axis] >= blockCount[axis])
+				return false;
+		}
+		return false;
+	}
+
+	bool traceCells(const float* origin, const float* direction, const float* invDirection, const int* stepDir, float tStart, float tEnd, rayHit& hit) const
+	{
+		const float epsilon = 1e-4f;
+		int size[3] = { sizeX, sizeY, sizeZ };
+		int* cell = hit.cell;
+		float tNext[3], tDelta[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float p = origin[axis] + direction[axis] * (tStart + epsilon);
+			cell[axis] = std::min(std::max((int)std::floor(p), 0), size[axis] - 1);
+			tNext[axis] = (cell[axis] + (stepDir[axis] > 0) - origin[axis]) * invDirection[axis];
+			tDelta[axis] = std::fabs(invDirection[axis]);
+		}
+
+		float t = tStart;
+		while (t < tEnd)
+		{
+			if (cells[cellIndex(cell[0], cell[1], cell[2])])
+			{
+				hit.t = t;
+				return true;
+			}
+			int axis = tNext[0] <= tNext[1] && tNext[0] <= tNext[2] ? 0 : (tNext[1] <= tNext[2] ? 1 : 2);
+			t = tNext[axis];
+			cell[axis] += stepDir[axis];
+			tNext[axis] += tDelta[axis];
+			if (cell[axis] < 0 || cell[axis] >= size[axis])
+				return false;
+		}
+		return false;
+	}
+};
+
+#endif
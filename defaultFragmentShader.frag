@@ -1,9 +1,20 @@
 #version 460 core
 
 in vec3 localPos;
+flat in uint material;
 out vec4 FragColor;
 
+//Set while drawing the static obstacles, which are shaded grey
+uniform int obstaclePass;
+
 void main()
 {
-   FragColor = vec4(localPos, 1.0);
+   if (obstaclePass != 0 || material == 3u)
+      FragColor = vec4(vec3(0.45) + 0.1 * localPos, 1.0);
+   else if (material == 1u)
+      FragColor = vec4(vec3(0.85, 0.7, 0.4) + 0.1 * localPos, 1.0);
+   else if (material == 2u)
+      FragColor = vec4(vec3(0.3, 0.2, 0.05) + 0.1 * localPos, 1.0);
+   else
+      FragColor = vec4(localPos, 1.0);
 }
\ No newline at end of file
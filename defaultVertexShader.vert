@@ -1,17 +1,36 @@
 #version 460 core
 
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aOffset;
+//Cell coordinates packed 10-10-10 with a 2 bit material on top, see voxelInstance.h
+layout (location = 1) in uint aPackedCell;
 
 out vec3 localPos;
+//Colour index from the top two bits: water, sand, oil, solid
+flat out uint material;
 
 uniform mat4 modelToWorld;
-uniform mat4 view;
-uniform mat4 projection;
+uniform float voxelSpacing;
+//A cell at lodLevel covers 2^lodLevel voxels per axis, see occupancyPyramid.h
+uniform int lodLevel;
+
+//Per-frame state, see frameUniforms.h
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+    mat4 inverseViewProjection;
+};
 
 //Remember to multiply in reverse order
 void main()
 {
 	localPos = aPos;
-    gl_Position = projection * view * modelToWorld * (vec4(aPos + aOffset, 1.0));
+	material = aPackedCell >> 30;
+	uvec3 cell = uvec3(aPackedCell, aPackedCell >> 10, aPackedCell >> 20) & 1023u;
+	float span = float(1 << lodLevel);
+	vec3 aOffset = (vec3(cell) * span + (span - 1.0) * 0.5) * voxelSpacing;
+    gl_Position = viewProjection * modelToWorld * (vec4(aPos * (1.0 + (span - 1.0) * voxelSpacing * 0.5) + aOffset, 1.0));
 }
@@ -0,0 +1,195 @@
+#ifndef DENSITY_RULE_H
+#define DENSITY_RULE_H
+
+#include "voxelGrid.h"
+#include "jobSystem.h"
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+//Multi-material step driven by the pair table in voxelMaterial.h. Materials are copied into a dense byte buffer with y
+//slowest, above an extra floor layer of solid, and the step runs three passes over disjoint pairs of cells. Each pair
+//decides from table lookups, without branching, whether its two cells trade contents:
+//  1. Vertical: pairs (y, y + 1) with y of the step's parity. The upper cell trades with the lower one when it falls
+//     into it, so voxels fall into empty cells and heavier materials sink through lighter ones.
+//  2. Along x, then 3. along z, pairs of neighbours starting at the step's parity (the z pass uses the next bit of the
+//     step). A voxel moves into a lighter neighbour if what is below holds it up and it either flows (liquids) or can
+//     fall on from the neighbouring cell (granular toppling). A hash of the pair and step lets half of the pairs act, so
+//     liquids spread as a random walk instead of marching one way.
+//No cell is in two pairs of a pass, so a pass doesn't depend on the order pairs are visited in and its layers run as
+//jobs; sideways moves look at the layer below, so even layers spread first and odd layers after them. A buffer of
+//origins is swapped along with the materials, and the cells whose contents changed are mirrored into the grid with the
+//velocity of the voxel that arrived. Obstacle cells enter the buffer as solid.
+
+class DensityRule
+{
+public:
+	//Applies one step and returns the number of cells whose contents changed
+	template <typename Grid, typename Obstacles>
+	int apply(Grid& grid, unsigned step, const Obstacles& obstacles, JobSystem& jobs)
+	{
+		sizeX = grid.sizeX;
+		sizeY = grid.sizeY;
+		sizeZ = grid.sizeZ;
+		layerCells = sizeX * sizeZ;
+		size_t cellCount = (size_t)layerCells * (sizeY + 1);
+		if (materials.size() != cellCount)
+		{
+			materials.assign(cellCount, MATERIAL_EMPTY);
+			origins.assign(cellCount, 0);
+		}
+
+		std::fill(materials.begin(), materials.begin() + layerCells, (uint8_t)MATERIAL_SOLID);
+		std::fill(materials.begin() + layerCells, materials.end(), (uint8_t)MATERIAL_EMPTY);
+		for (int x = 0; x < sizeX; x++)
+			for (int y = 0; y < sizeY; y++)
+				for (int z = 0; z < sizeZ; z++)
+					if (obstacles.isSolid(x, y, z))
+						materials[index(x, y, z)] = MATERIAL_SOLID;
+		grid.forEachVoxel([&](int x, int y, int z, const voxelPosition& cell)
+		{
+			materials[index(x, y, z)] = cell.material;
+		});
+		for (size_t n = 0; n < cellCount; n++)
+			origins[n] = (int32_t)n;
+
+		int parity = step & 1;
+		jobs.parallelFor(0, (sizeY - parity) / 2, [&](int begin, int end, int)
+		{
+			for (int pair = begin; pair < end; pair++)
+				fallPass(parity + 2 * pair);
+		});
+		//Spreading reads the layer below, so even layers spread before odd ones
+		for (int layerParity = 0; layerParity < 2; layerParity++)
+		{
+			jobs.parallelFor(0, (sizeY + 1 - layerParity) / 2, [&](int begin, int end, int)
+			{
+				for (int y = layerParity + 2 * begin; y < layerParity + 2 * end; y += 2)
+				{
+					spreadPass(y, sizeZ, step & 1, step);
+					spreadPass(y, 1, (step >> 1) & 1, step);
+				}
+			});
+		}
+
+		//Mirror the changes into the grid, reading every arriving voxel's velocity before any cell is written
+		moves.clear();
+		emptied.clear();
+		for (size_t n = layerCells; n < cellCount; n++)
+		{
+			if (origins[n] == (int32_t)n)
+				continue;
+			if (materials[n] == MATERIAL_EMPTY)
+				emptied.push_back((int)n);
+			else
+				moves.push_back(std::make_pair((int)origins[n], (int)n));
+		}
+
+		velocities.resize(moves.size());
+		for (size_t m = 0; m < moves.size(); m++)
+		{
+			int x, y, z;
+			coords(moves[m].first, x, y, z);
+			velocities[m] = grid.at(x, y, z).velocity;
+		}
+		for (int n : emptied)
+		{
+			int x, y, z;
+			coords(n, x, y, z);
+			grid.removeVoxel(x, y, z);
+		}
+		for (size_t m = 0; m < moves.size(); m++)
+		{
+			int x, y, z;
+			coords(moves[m].second, x, y, z);
+			grid.placeVoxel(x, y, z, velocities[m], materials[moves[m].second]);
+		}
+		return (int)(moves.size() + emptied.size());
+	}
+
+	//Materials after the last step, one byte per cell with y slowest, starting with the floor layer
+	const std::vector<uint8_t>& materialBuffer() const { return materials; }
+
+private:
+	int sizeX = 0;
+	int sizeY = 0;
+	int sizeZ = 0;
+	int layerCells = 0;
+
+	std::vector<uint8_t> materials;
+	//Buffer index each cell's contents started the step in
+	std::vector<int32_t> origins;
+
+	//Mirroring scratch, kept between steps to avoid allocating
+	std::vector<std::pair<int, int>> moves;
+	std::vector<int> emptied;
+	std::vector<glm::vec3> velocities;
+
+	//Layer y + 1 of the buffer holds grid layer y
+	size_t index(int x, int y, int z) const { return (size_t)(y + 1) * layerCells + x * sizeZ + z; }
+
+	void coords(int n, int& x, int& y, int& z) const
+	{
+		y = n / layerCells - 1;
+		x = (n % layerCells) / sizeZ;
+		z = n % sizeZ;
+	}
+
+	static unsigned falls(uint8_t above, uint8_t below) { return materialPairs.falls[above][below]; }
+
+	//Trades the contents of cells a and b if swap is 1, without branching
+	void exchange(size_t a, size_t b, unsigned swap)
+	{
+		uint8_t materialMask = (uint8_t)(0u - swap);
+		uint8_t materialDifference = (materials[a] ^ materials[b]) & materialMask;
+		materials[a] ^= materialDifference;
+		materials[b] ^= materialDifference;
+
+		int32_t originMask = -(int32_t)swap;
+		int32_t originDifference = (origins[a] ^ origins[b]) & originMask;
+		origins[a] ^= originDifference;
+		origins[b] ^= originDifference;
+	}
+
+	//Grid layers y and y + 1
+	void fallPass(int y)
+	{
+		size_t lower = (size_t)(y + 1) * layerCells;
+		size_t upper = lower + layerCells;
+		for (int c = 0; c < layerCells; c++)
+			exchange(lower + c, upper + c, falls(materials[upper + c], materials[lower + c]));
+	}
+
+	//Pairs along x (stride sizeZ) or z (stride 1) in grid layer y, the first cell of each at the given parity
+	void spreadPass(int y, int stride, int parity, unsigned step)
+	{
+		size_t layer = (size_t)(y + 1) * layerCells;
+		size_t floor = layer - layerCells;
+		bool alongX = stride != 1;
+		for (int x = alongX ? parity : 0; x < (alongX ? sizeX - 1 : sizeX); x += alongX ? 2 : 1)
+		{
+			for (int z = alongX ? 0 : parity; z < (alongX ? sizeZ : sizeZ - 1); z += alongX ? 1 : 2)
+			{
+				int c = x * sizeZ + z;
+				uint8_t p = materials[layer + c], q = materials[layer + c + stride];
+				uint8_t pBelow = materials[floor + c], qBelow = materials[floor + c + stride];
+				unsigned toQ = falls(p, q) & (falls(p, pBelow) ^ 1) & ((unsigned)materialFlows[p] | falls(p, qBelow));
+				unsigned toP = falls(q, p) & (falls(q, qBelow) ^ 1) & ((unsigned)materialFlows[q] | falls(q, pBelow));
+				exchange(layer + c, layer + c + stride, (toQ | toP) & pairHash((uint32_t)(layer + c), step * 2 + alongX));
+			}
+		}
+	}
+
+	//One pseudo-random bit per pair and pass
+	static unsigned pairHash(uint32_t cell, uint32_t pass)
+	{
+		uint32_t h = cell * 0x8da6b343u ^ pass * 0x165667b1u;
+		h ^= h >> 15;
+		h *= 0x2c1b3c6du;
+		h ^= h >> 12;
+		return h & 1;
+	}
+};
+
+#endif
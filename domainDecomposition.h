@@ -0,0 +1,256 @@
+#ifndef DOMAIN_DECOMPOSITION_H
+#define DOMAIN_DECOMPOSITION_H
+
+#include "voxelGrid.h"
+#include <vector>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <pthread.h>
+#endif
+
+//Splits the domain into slabs along x, one per process. Each slab keeps one ghost layer on either side holding the
+//neighbouring slab's boundary occupancy from the start of the step. A voxel that moves into a ghost cell migrates to
+//the neighbour, which places it in the same cell of its boundary layer. Every shared boundary cell has one owner per
+//step, alternating in a checkerboard over (y, z) and steps: on the sender's turn only the sender may move into it
+//(through its ghost cell) and the receiver sees it as full; otherwise the sender sees the ghost cell as full. A migrant
+//therefore always finds its cell free, and a move the owner rules out leaves the voxel where it was on the sender.
+//Processes on one host talk through SlabExchange, a MAP_SHARED mapping created before fork() that stands in for MPI.
+
+struct migrantVoxel
+{
+	int y;
+	int z;
+	glm::vec3 velocity;
+	uint8_t material;
+};
+
+//Grid interface from voxelGrid.h over one slab. x = 0 and x = sizeX - 1 are the ghost layers.
+class SlabGrid
+{
+public:
+	const int sizeX;
+	const int sizeY;
+	const int sizeZ;
+
+	//Voxels that moved into the low (0) or high (1) ghost layer during the last sweep
+	std::vector<migrantVoxel> outgoing[2];
+
+	SlabGrid(int width, int y, int z) : sizeX(width + 2), sizeY(y), sizeZ(z), cells(width + 2, y, z) {}
+
+	//Cells this step's turns keep this rank out of read as full, so the rules leave them alone
+	bool containsVoxel(int x, int y, int z) const { return cells.containsVoxel(x, y, z) || !mayEnter(x, y, z); }
+
+	//Sets whose turn each shared boundary cell is on; call before the rule runs
+	void beginStep(unsigned s) { step = s; }
+
+	voxelPosition& at(int x, int y, int z) { return cells.at(x, y, z); }
+
+	uint8_t materialAt(int x, int y, int z) const { return cells.materialAt(x, y, z); }
+
+	//Moves into a ghost cell are recorded as migrants; the cell is marked full so nothing else moves there this step
+	void placeVoxel(int x, int y, int z, glm::vec3 velocity = glm::vec3(0.0f), uint8_t material = MATERIAL_WATER)
+	{
+		if (x == 0 || x == sizeX - 1)
+		{
+			migrantVoxel migrant;
+			migrant.y = y;
+			migrant.z = z;
+			migrant.velocity = velocity;
+			migrant.material = material;
+			outgoing[x == 0 ? 0 : 1].push_back(migrant);
+		}
+		cells.placeVoxel(x, y, z, velocity, material);
+	}
+
+	void removeVoxel(int x, int y, int z) { cells.removeVoxel(x, y, z); }
+
+	//Interior cells only
+	template <typename F>
+	void sweep(F f)
+	{
+		for (int i = 1; i < sizeX - 1; i++)
+			for (int j = 0; j < sizeY; j++)
+				for (int k = 0; k < sizeZ; k++)
+					if (cells.containsVoxel(i, j, k))
+						f(i, j, k);
+	}
+
+	template <typename F>
+	void forEachVoxel(F f) const
+	{
+		cells.forEachVoxel([&](int i, int j, int k, const voxelPosition& cell)
+		{
+			if (i > 0 && i < sizeX - 1)
+				f(i, j, k, cell);
+		});
+	}
+
+	size_t memoryBytes() const { return cells.memoryBytes(); }
+
+	//Copies the boundary layer on one side into a sizeY * sizeZ occupancy plane
+	void storeBoundary(int side, unsigned char* plane) const
+	{
+		int x = side == 0 ? 1 : sizeX - 2;
+		for (int j = 0; j < sizeY; j++)
+			for (int k = 0; k < sizeZ; k++)
+				plane[j * sizeZ + k] = cells.containsVoxel(x, j, k) ? 1 : 0;
+	}
+
+	//Fills a ghost layer from a neighbour's boundary plane. A null plane is a domain wall and fills the layer solid.
+	void loadGhost(int side, const unsigned char* plane)
+	{
+		int x = side == 0 ? 0 : sizeX - 1;
+		wall[side] = plane == nullptr;
+		for (int j = 0; j < sizeY; j++)
+		{
+			for (int k = 0; k < sizeZ; k++)
+			{
+				if (!plane || plane[j * sizeZ + k])
+					cells.placeVoxel(x, j, k);
+				else
+					cells.removeVoxel(x, j, k);
+			}
+		}
+	}
+
+	//Places voxels arriving through one side. Returns how many found their cell taken, which the turns rule out; those
+	//are reported and dropped.
+	int acceptMigrants(int side, const migrantVoxel* migrants, int count)
+	{
+		int x = side == 0 ? 1 : sizeX - 2;
+		int displaced = 0;
+		for (int m = 0; m < count; m++)
+		{
+			const migrantVoxel& migrant = migrants[m];
+			if (cells.containsVoxel(x, migrant.y, migrant.z))
+			{
+				std::cout << "ERROR::SLAB_GRID::MIGRANT_CELL_TAKEN: " << migrant.y << " " << migrant.z << std::endl;
+				displaced++;
+				continue;
+			}
+			cells.placeVoxel(x, migrant.y, migrant.z, migrant.velocity, migrant.material);
+		}
+		return displaced;
+	}
+
+	long long voxelCount() const
+	{
+		long long count = 0;
+		forEachVoxel([&](int, int, int, const voxelPosition&) { count++; });
+		return count;
+	}
+
+private:
+	DenseVoxelGrid cells;
+
+	unsigned step = 0;
+	//Sides whose ghost layer is a domain wall, where nothing arrives
+	bool wall[2] = { true, true };
+
+	//Whether the sender into the boundary cell (y, z) on the receiver's given side has this step's turn. The two sides
+	//take opposite turns, so a one cell wide slab is never sent into from both sides at once.
+	bool sendersTurn(int side, int y, int z) const { return ((y + z + step + side) & 1) == 0; }
+
+	bool mayEnter(int x, int y, int z) const
+	{
+		//Ghost cells are the neighbours' boundary cells: high ghost is the low side of the next slab and the other way
+		if (x == 0)
+			return sendersTurn(1, y, z);
+		if (x == sizeX - 1)
+			return sendersTurn(0, y, z);
+		if (x == 1 && !wall[0] && sendersTurn(0, y, z))
+			return false;
+		if (x == sizeX - 2 && !wall[1] && sendersTurn(1, y, z))
+			return false;
+		return true;
+	}
+};
+
+#if defined(__linux__)
+
+//Shared memory visible to every rank after fork(): a process-shared barrier, per-rank halo planes, migrant mailboxes
+//and result slots.
+class SlabExchange
+{
+public:
+	struct rankSlot
+	{
+		long long voxelCount;
+		double stepSeconds;
+		int migrantCount[2];
+		int displaced;
+	};
+
+	SlabExchange(int _ranks, int _planeY, int _planeZ) : ranks(_ranks), planeCells((size_t)_planeY * _planeZ)
+	{
+		planeOffset = align(sizeof(pthread_barrier_t));
+		slotOffset = align(planeOffset + ranks * 2 * planeCells);
+		migrantOffset = align(slotOffset + ranks * sizeof(rankSlot));
+		totalBytes = migrantOffset + ranks * 2 * planeCells * sizeof(migrantVoxel);
+
+		void* mapping = mmap(nullptr, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED)
+		{
+			std::cout << "ERROR::SLAB_EXCHANGE::MMAP_FAILED" << std::endl;
+			base = nullptr;
+			return;
+		}
+		base = static_cast<unsigned char*>(mapping);
+		memset(base, 0, totalBytes);
+
+		pthread_barrierattr_t attributes;
+		pthread_barrierattr_init(&attributes);
+		pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+		pthread_barrier_init(barrierHandle(), &attributes, ranks);
+		pthread_barrierattr_destroy(&attributes);
+	}
+
+	~SlabExchange()
+	{
+		if (!base)
+			return;
+		if (!abandoned)
+			pthread_barrier_destroy(barrierHandle());
+		munmap(base, totalBytes);
+	}
+
+	SlabExchange(const SlabExchange&) = delete;
+	SlabExchange& operator=(const SlabExchange&) = delete;
+
+	bool valid() const { return base != nullptr; }
+
+	void barrier() { pthread_barrier_wait(barrierHandle()); }
+
+	//Call after killing ranks that may be waiting in the barrier; destroying it would wait for them to leave
+	void abandonBarrier() { abandoned = true; }
+
+	//side 0 is the low-x boundary of the rank, side 1 the high-x boundary
+	unsigned char* haloPlane(int rank, int side) { return base + planeOffset + (rank * 2 + side) * planeCells; }
+
+	migrantVoxel* migrants(int rank, int side) { return reinterpret_cast<migrantVoxel*>(base + migrantOffset) + (rank * 2 + side) * planeCells; }
+
+	rankSlot& slot(int rank) { return reinterpret_cast<rankSlot*>(base + slotOffset)[rank]; }
+
+	size_t planeSize() const { return planeCells; }
+
+private:
+	int ranks;
+	size_t planeCells;
+	size_t planeOffset;
+	size_t slotOffset;
+	size_t migrantOffset;
+	size_t totalBytes;
+	unsigned char* base;
+	bool abandoned = false;
+
+	static size_t align(size_t offset) { return (offset + 63) & ~(size_t)63; }
+
+	pthread_barrier_t* barrierHandle() { return reinterpret_cast<pthread_barrier_t*>(base); }
+};
+
+#endif
+
+#endif
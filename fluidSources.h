@@ -0,0 +1,188 @@
+#ifndef FLUID_SOURCES_H
+#define FLUID_SOURCES_H
+
+#include "voxelGrid.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <random>
+#include <algorithm>
+#include <cctype>
+
+//Emitters that add fluid to a box of cells and sinks that take it away, at a rate in voxels per simulation step.
+//Fractional rates carry over between steps, so a rate of 0.25 adds one voxel every fourth step. An emitter places
+//voxels in random free cells of its box and gives up on the rest of a step's voxels once its box is nearly full;
+//a sink removes voxels in its box in a fixed cell order that carries on where the last step stopped, so a sink slower
+//than the inflow drains its whole box evenly.
+//
+//Source files hold one volume per line, in inclusive cell coordinates, with # starting a comment:
+//  emitter x0 y0 z0 x1 y1 z1 rate [material] [vx vy vz]    material is water, sand, oil or solid (water if left
+//                                                          out); vx vy vz is the velocity new voxels start with
+//  sink x0 y0 z0 x1 y1 z1 [rate]                           without a rate the sink empties its box every step
+
+class FluidSources
+{
+public:
+	//Totals since loading
+	long long spawned = 0;
+	long long drained = 0;
+
+	//Adds the volumes in path, returning false if it can't be read. Lines that don't parse are reported and skipped.
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "ERROR::SOURCES::FILE_NOT_READ: " << path << std::endl;
+			return false;
+		}
+
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(file, line))
+		{
+			lineNumber++;
+			line = line.substr(0, line.find('#'));
+			std::istringstream words(line);
+			std::string kind;
+			if (!(words >> kind))
+				continue;
+
+			volume entry;
+			int x0, y0, z0, x1, y1, z1;
+			bool parsed = (kind == "emitter" || kind == "sink") && (words >> x0 >> y0 >> z0 >> x1 >> y1 >> z1);
+			if (parsed && kind == "emitter")
+			{
+				parsed = (bool)(words >> entry.rate);
+				//A word after the rate names the material; otherwise go back to read the velocity from it
+				std::streampos afterRate = words.tellg();
+				std::string material;
+				if (parsed && words >> material && std::isalpha((unsigned char)material[0]))
+				{
+					entry.material = parseMaterial(material.c_str());
+					parsed = entry.material != MATERIAL_EMPTY;
+				}
+				else
+				{
+					words.clear();
+					words.seekg(afterRate);
+				}
+				float vx, vy, vz;
+				if (parsed && words >> vx >> vy >> vz)
+					entry.velocity = glm::vec3(vx, vy, vz);
+			}
+			else if (parsed && !(words >> entry.rate))
+			{
+				entry.rate = UNLIMITED;
+			}
+			if (!parsed)
+			{
+				std::cout << "ERROR::SOURCES::BAD_LINE: " << path << ":" << lineNumber << std::endl;
+				continue;
+			}
+
+			entry.low = vec3Int(std::min(x0, x1), std::min(y0, y1), std::min(z0, z1));
+			entry.high = vec3Int(std::max(x0, x1), std::max(y0, y1), std::max(z0, z1));
+			(kind == "emitter" ? emitters : sinks).push_back(entry);
+		}
+		return true;
+	}
+
+	bool empty() const { return emitters.empty() && sinks.empty(); }
+	int emitterCount() const { return (int)emitters.size(); }
+	int sinkCount() const { return (int)sinks.size(); }
+
+	//Runs every emitter and sink for one step. Emitters skip cells obstacles.isSolid() reports.
+	template <typename Grid, typename Obstacles>
+	void apply(Grid& grid, const Obstacles& obstacles, std::mt19937& random)
+	{
+		for (volume& emitter : emitters)
+		{
+			int wanted = takeDue(emitter);
+			vec3Int low, high;
+			if (wanted == 0 || !clampToGrid(grid, emitter, low, high))
+				continue;
+
+			std::uniform_int_distribution<int> pickX(low.x, high.x), pickY(low.y, high.y), pickZ(low.z, high.z);
+			int placed = 0;
+			for (int attempt = 0; attempt < 4 * wanted && placed < wanted; attempt++)
+			{
+				int x = pickX(random), y = pickY(random), z = pickZ(random);
+				if (grid.containsVoxel(x, y, z) || obstacles.isSolid(x, y, z))
+					continue;
+				grid.placeVoxel(x, y, z, emitter.velocity, emitter.material);
+				placed++;
+			}
+			spawned += placed;
+		}
+
+		for (volume& sink : sinks)
+		{
+			int wanted = takeDue(sink);
+			vec3Int low, high;
+			if (wanted == 0 || !clampToGrid(grid, sink, low, high))
+				continue;
+
+			int sizeX = high.x - low.x + 1, sizeY = high.y - low.y + 1, sizeZ = high.z - low.z + 1;
+			long long cells = (long long)sizeX * sizeY * sizeZ;
+			int removed = 0;
+			for (long long visited = 0; visited < cells && removed < wanted; visited++)
+			{
+				long long cell = (sink.cursor + visited) % cells;
+				int x = low.x + (int)(cell / ((long long)sizeY * sizeZ));
+				int y = low.y + (int)((cell / sizeZ) % sizeY);
+				int z = low.z + (int)(cell % sizeZ);
+				if (!grid.containsVoxel(x, y, z))
+					continue;
+				grid.removeVoxel(x, y, z);
+				removed++;
+				sink.cursor = (cell + 1) % cells;
+			}
+			drained += removed;
+		}
+	}
+
+private:
+	enum { UNLIMITED = -1 };
+
+	struct volume
+	{
+		vec3Int low;
+		vec3Int high;
+		float rate = 0;
+		glm::vec3 velocity = glm::vec3(0.0f);
+		uint8_t material = MATERIAL_WATER;
+		//Fraction of a voxel carried over to the next step
+		float owed = 0;
+		//Sinks: where the next scan of the box starts
+		long long cursor = 0;
+	};
+
+	std::vector<volume> emitters;
+	std::vector<volume> sinks;
+
+	//Whole voxels due this step
+	static int takeDue(volume& entry)
+	{
+		if (entry.rate < 0)
+			return 1 << 30;
+		entry.owed += entry.rate;
+		int due = (int)entry.owed;
+		entry.owed -= due;
+		return due;
+	}
+
+	//The part of the volume inside the grid, false if none is
+	template <typename Grid>
+	static bool clampToGrid(const Grid& grid, const volume& entry, vec3Int& low, vec3Int& high)
+	{
+		low = vec3Int(std::max(entry.low.x, 0), std::max(entry.low.y, 0), std::max(entry.low.z, 0));
+		high = vec3Int(std::min(entry.high.x, grid.sizeX - 1), std::min(entry.high.y, grid.sizeY - 1), std::min(entry.high.z, grid.sizeZ - 1));
+		return low.x <= high.x && low.y <= high.y && low.z <= high.z;
+	}
+};
+
+#endif
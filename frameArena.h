@@ -0,0 +1,179 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include "jobSystem.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+//Memory for buffers that only live for one frame (instance lists, meshing worklists and the like). Allocation bumps an
+//offset into a block and freeing does nothing; reset() at the start of the next frame releases everything at once.
+//If a frame asks for more than the block holds, extra blocks are taken from the heap, and the next reset() swaps them
+//all for one block big enough for that frame, so after a few frames the arena stops touching the heap.
+//
+//FrameArenas gives every job system worker its own arena, so jobs allocate without locking: a job uses
+//arenas.current() (or arenas[worker]) and never another worker's arena.
+
+//Builds with -DCOUNT_HEAP_ALLOCATIONS count every global operator new here (the replacement is in main.cpp), to check
+//that frames which should not touch the heap really don't. It is opt-in so no build replaces the allocator by default.
+
+inline std::atomic<long long>& heapAllocationCount()
+{
+	static std::atomic<long long> count{ 0 };
+	return count;
+}
+
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t bytes = 64 * 1024)
+	{
+		addBlock(bytes);
+	}
+
+	//alignment must be a power of two no larger than alignof(std::max_align_t)
+	void* allocate(size_t bytes, size_t alignment)
+	{
+		size_t offset = (used + alignment - 1) & ~(alignment - 1);
+		if (offset + bytes > blockSizes.back())
+		{
+			addBlock(std::max(bytes, 2 * blockSizes.back()));
+			offset = 0;
+		}
+		frameBytes += offset + bytes - used;
+		used = offset + bytes;
+		highWater = std::max(highWater, frameBytes);
+		return blocks.back().get() + offset;
+	}
+
+	template <typename T>
+	T* allocateArray(size_t count)
+	{
+		return (T*)allocate(count * sizeof(T), alignof(T));
+	}
+
+	//Frees everything allocated since the last reset
+	void reset()
+	{
+		if (blocks.size() > 1)
+		{
+			size_t total = 0;
+			for (size_t bytes : blockSizes)
+				total += bytes;
+			blocks.clear();
+			blockSizes.clear();
+			addBlock(total);
+			overflows++;
+		}
+		used = 0;
+		frameBytes = 0;
+	}
+
+	//Most bytes handed out between two resets, including alignment padding
+	size_t highWaterBytes() const { return highWater; }
+
+	size_t capacityBytes() const
+	{
+		size_t total = 0;
+		for (size_t bytes : blockSizes)
+			total += bytes;
+		return total;
+	}
+
+	//Frames that outgrew the arena and made it allocate from the heap
+	int overflowCount() const { return overflows; }
+
+private:
+	std::vector<std::unique_ptr<unsigned char[]>> blocks;
+	std::vector<size_t> blockSizes;
+	size_t used = 0;
+	size_t frameBytes = 0;
+	size_t highWater = 0;
+	int overflows = 0;
+
+	void addBlock(size_t bytes)
+	{
+		blocks.emplace_back(new unsigned char[bytes]);
+		blockSizes.push_back(bytes);
+		used = 0;
+	}
+};
+
+//Standard allocator over a FrameArena, for containers that are thrown away with the frame
+template <typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count) { return arena->allocateArray<T>(count); }
+	void deallocate(T*, size_t) {}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+	template <typename U> friend class ArenaAllocator;
+	FrameArena* arena;
+};
+
+template <typename T>
+using arenaVector = std::vector<T, ArenaAllocator<T>>;
+
+//One FrameArena per worker of a job system
+class FrameArenas
+{
+public:
+	FrameArenas(const JobSystem& jobs) : jobs(jobs), arenas(jobs) {}
+
+	FrameArena& operator[](int worker) { return arenas[worker]; }
+
+	//The calling worker's arena
+	FrameArena& current() { return arenas[jobs.currentWorker()]; }
+
+	//Only while no job is using any of the arenas
+	void reset()
+	{
+		for (int w = 0; w < arenas.size(); w++)
+			arenas[w].reset();
+	}
+
+	size_t highWaterBytes() const
+	{
+		size_t total = 0;
+		for (int w = 0; w < arenas.size(); w++)
+			total += arenas[w].highWaterBytes();
+		return total;
+	}
+
+	size_t capacityBytes() const
+	{
+		size_t total = 0;
+		for (int w = 0; w < arenas.size(); w++)
+			total += arenas[w].capacityBytes();
+		return total;
+	}
+
+	int overflowCount() const
+	{
+		int total = 0;
+		for (int w = 0; w < arenas.size(); w++)
+			total += arenas[w].overflowCount();
+		return total;
+	}
+
+private:
+	const JobSystem& jobs;
+	WorkerLocal<FrameArena> arenas;
+};
+
+#endif
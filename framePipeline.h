@@ -0,0 +1,119 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include "jobSystem.h"
+#include "frameArena.h"
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+//Runs the CPU side of each frame (a simulation step, then building its instances) as jobs, so the render thread can
+//upload and draw one frame while the workers step and build the next. The stages are ordered by job dependencies:
+//  simulate N   after build N-1, which reads the grid this step writes
+//  build N      after simulate N, into slot N % framesInFlight
+//  draw N       on the render thread, once waitOldest() has seen build N finish
+//At most framesInFlight frames are queued and not yet drawn, so by the time build N runs, frame N - framesInFlight has
+//been drawn and its slot is free. With framesInFlight 1 each frame is stepped, built and drawn in turn.
+//
+//The stages are given once; each frame only passes the Inputs they read (keys, camera), which are copied into the
+//frame's slot. The pipeline owns one FrameArena per worker for the stages' scratch memory. They are reset when a
+//frame's simulate stage starts, which is after every earlier stage has finished, so buffers from them must not be kept
+//past the build stage, except by the render thread while framesInFlight is 1.
+
+template <typename Inputs>
+class FramePipeline
+{
+public:
+	typedef std::function<void(const Inputs&)> simulateStage;
+	typedef std::function<void(const Inputs&, int slot, FrameArenas& arenas)> buildStage;
+
+	//Totals over all frames; simulate and build are measured on whichever worker ran them
+	double simulateMilliseconds = 0;
+	double buildMilliseconds = 0;
+	//Time the render thread spent in waitOldest(), helping with or waiting for the CPU stages
+	double waitMilliseconds = 0;
+
+	FramePipeline(JobSystem& jobs, int framesInFlight, simulateStage simulate, buildStage build)
+		: jobs(jobs), depth(std::max(1, framesInFlight)), simulate(simulate), build(build), frameArenas(jobs), slots(depth)
+	{
+	}
+
+	~FramePipeline() { drain(); }
+
+	int framesInFlight() const { return depth; }
+
+	FrameArenas& arenas() { return frameArenas; }
+
+	//True once framesInFlight frames are queued; the oldest has to be drawn and retired before the next submit
+	bool full() const { return queued >= depth; }
+
+	//Queues the next frame: simulate, then build into its slot. Must not be called while full().
+	void submit(const Inputs& inputs)
+	{
+		int slot = (oldest + queued) % depth;
+		slots[slot].inputs = inputs;
+
+		JobSystem::JobHandle step = jobs.submit([this, slot](int)
+		{
+			auto start = std::chrono::steady_clock::now();
+			frameArenas.reset();
+			simulate(slots[slot].inputs);
+			simulateMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}, { lastBuild });
+		lastBuild = jobs.submit([this, slot](int)
+		{
+			auto start = std::chrono::steady_clock::now();
+			build(slots[slot].inputs, slot, frameArenas);
+			buildMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}, { step });
+		slots[slot].built = lastBuild;
+		queued++;
+	}
+
+	//Waits for the oldest queued frame to be built and returns its slot
+	int waitOldest()
+	{
+		auto start = std::chrono::steady_clock::now();
+		jobs.wait(slots[oldest].built);
+		waitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return oldest;
+	}
+
+	//Frees the oldest frame's slot once its instances are uploaded
+	void retire()
+	{
+		slots[oldest].built = JobSystem::JobHandle();
+		oldest = (oldest + 1) % depth;
+		queued--;
+	}
+
+	//Waits for every queued frame and drops them undrawn
+	void drain()
+	{
+		while (queued > 0)
+		{
+			waitOldest();
+			retire();
+		}
+	}
+
+private:
+	struct frameSlot
+	{
+		Inputs inputs;
+		JobSystem::JobHandle built;
+	};
+
+	JobSystem& jobs;
+	int depth;
+	simulateStage simulate;
+	buildStage build;
+	FrameArenas frameArenas;
+	std::vector<frameSlot> slots;
+	int oldest = 0;
+	int queued = 0;
+	JobSystem::JobHandle lastBuild;
+};
+
+#endif
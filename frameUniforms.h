@@ -0,0 +1,51 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+//Per-frame state shared by every shader program through one uniform buffer. Programs declare the std140 block
+//	layout (std140) uniform FrameData
+//	{ mat4 view; mat4 projection; mat4 viewProjection; vec3 cameraPosition; float time; mat4 inverseViewProjection; };
+//and are connected to it with shader.bindUniformBlock("FrameData", FrameUniformBuffer::BINDING). The buffer is uploaded
+//once per frame, so the per-frame driver calls stay the same however many programs read it.
+
+struct frameUniforms
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+	glm::vec3 cameraPosition;
+	//Fills the last 4 bytes of cameraPosition's 16 byte std140 slot
+	float time;
+	//For turning screen positions back into rays
+	glm::mat4 inverseViewProjection;
+};
+
+static_assert(sizeof(frameUniforms) == 4 * 64 + 16, "frameUniforms must match the std140 FrameData block");
+
+class FrameUniformBuffer
+{
+public:
+	enum { BINDING = 0 };
+
+	//Needs a current context. Like the other GL objects in main.cpp the buffer lives until the context is destroyed.
+	FrameUniformBuffer()
+	{
+		glGenBuffers(1, &ubo);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(frameUniforms), NULL, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, ubo);
+	}
+
+	void update(const frameUniforms& data)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frameUniforms), &data);
+	}
+
+private:
+	unsigned int ubo;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+//Writes 8-bit RGB images, rows top to bottom, as binary PPM or PNG. The PNG writer stores the image data uncompressed
+//(deflate "stored" blocks) so it needs no zlib; files are about the size of the PPM but open anywhere.
+
+inline bool writePPM(const char* path, int width, int height, const uint8_t* rgb)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		std::cout << "ERROR::IMAGE_WRITER::CANNOT_OPEN: " << path << std::endl;
+		return false;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	fwrite(rgb, 1, (size_t)width * height * 3, file);
+	fclose(file);
+	return true;
+}
+
+inline uint32_t pngCrc(const uint8_t* data, size_t length, uint32_t crc = 0)
+{
+	static uint32_t table[256];
+	static bool tableReady = false;
+	if (!tableReady)
+	{
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		tableReady = true;
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+inline bool writePNG(const char* path, int width, int height, const uint8_t* rgb)
+{
+	//Filter type 0 byte before every row
+	size_t rowBytes = (size_t)width * 3 + 1;
+	std::vector<uint8_t> raw(rowBytes * height);
+	for (int y = 0; y < height; y++)
+	{
+		raw[y * rowBytes] = 0;
+		std::copy(rgb + (size_t)y * width * 3, rgb + (size_t)(y + 1) * width * 3, raw.begin() + y * rowBytes + 1);
+	}
+
+	//zlib stream of stored blocks, at most 65535 bytes each
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	uint32_t adlerA = 1, adlerB = 0;
+	for (size_t offset = 0;;)
+	{
+		size_t length = std::min<size_t>(65535, raw.size() - offset);
+		bool last = offset + length == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back(length & 0xff);
+		zlib.push_back((length >> 8) & 0xff);
+		zlib.push_back(~length & 0xff);
+		zlib.push_back((~length >> 8) & 0xff);
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+		//Adler-32; 5552 bytes is the most that can be summed before the 32-bit sums could overflow
+		for (size_t i = offset; i < offset + length; )
+		{
+			size_t end = std::min(offset + length, i + 5552);
+			for (; i < end; i++)
+			{
+				adlerA += raw[i];
+				adlerB += adlerA;
+			}
+			adlerA %= 65521;
+			adlerB %= 65521;
+		}
+		if (last)
+			break;
+		offset += length;
+	}
+	uint32_t adler = (adlerB << 16) | adlerA;
+	for (int shift = 24; shift >= 0; shift -= 8)
+		zlib.push_back((adler >> shift) & 0xff);
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		std::cout << "ERROR::IMAGE_WRITER::CANNOT_OPEN: " << path << std::endl;
+		return false;
+	}
+
+	auto writeChunk = [file](const char* type, const uint8_t* data, size_t length)
+	{
+		uint8_t header[8] = { (uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length,
+			(uint8_t)type[0], (uint8_t)type[1], (uint8_t)type[2], (uint8_t)type[3] };
+		uint32_t crc = pngCrc(header + 4, 4);
+		crc = pngCrc(data, length, crc);
+		uint8_t footer[4] = { (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+		fwrite(header, 1, 8, file);
+		fwrite(data, 1, length, file);
+		fwrite(footer, 1, 4, file);
+	};
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	fwrite(signature, 1, 8, file);
+	uint8_t header[13] = { (uint8_t)(width >> 24), (uint8_t)(width >> 16), (uint8_t)(width >> 8), (uint8_t)width,
+		(uint8_t)(height >> 24), (uint8_t)(height >> 16), (uint8_t)(height >> 8), (uint8_t)height,
+		8, 2, 0, 0, 0 };
+	writeChunk("IHDR", header, 13);
+	writeChunk("IDAT", zlib.data(), zlib.size());
+	writeChunk("IEND", NULL, 0);
+	fclose(file);
+	return true;
+}
+
+#endif
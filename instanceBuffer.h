@@ -0,0 +1,56 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <algorithm>
+
+//GPU buffer of per-instance data whose size follows the number of voxels. Uploads that fit overwrite the front of the
+//buffer with glBufferSubData; only an upload larger than the capacity reallocates, orphaning the old storage with
+//glBufferData at twice the capacity (or the upload size if that is larger). A scene that keeps gaining voxels then
+//reallocates a handful of times over its whole run instead of every frame, and the draw uses the live count, not the
+//capacity. Reallocating keeps the buffer name, so VAO attribute bindings and indexed bindings stay valid.
+
+class InstanceBuffer
+{
+public:
+	//Needs a current context. Like the other GL objects in main.cpp the buffer lives until the context is destroyed.
+	InstanceBuffer(GLenum target, size_t initialBytes) : target(target)
+	{
+		glGenBuffers(1, &id);
+		reserve(std::max<size_t>(initialBytes, 1));
+		reallocations = 0;
+	}
+
+	unsigned int name() const { return id; }
+	size_t capacityBytes() const { return capacity; }
+	//Times an upload outgrew the buffer
+	int reallocationCount() const { return reallocations; }
+
+	//Leaves the buffer bound to its target
+	void upload(const void* data, size_t bytes)
+	{
+		if (bytes > capacity)
+			reserve(std::max(bytes, 2 * capacity));
+		else
+			glBindBuffer(target, id);
+		if (bytes > 0)
+			glBufferSubData(target, 0, bytes, data);
+	}
+
+private:
+	GLenum target;
+	unsigned int id = 0;
+	size_t capacity = 0;
+	int reallocations = 0;
+
+	void reserve(size_t bytes)
+	{
+		glBindBuffer(target, id);
+		glBufferData(target, bytes, NULL, GL_DYNAMIC_DRAW);
+		capacity = bytes;
+		reallocations++;
+	}
+};
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef INTENT_RESOLVE_RULE_H
+#define INTENT_RESOLVE_RULE_H
+
+#include "voxelGrid.h"
+#include "jobSystem.h"
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+//Two-phase version of updateVoxelMatrixRandom whose result does not depend on visiting order or thread count.
+//  1. Snapshot: occupancy is copied into a dense read buffer, so every later read sees the state at the start of the step.
+//  2. Intent: every voxel picks the cell it wants (down if free, otherwise the first free side in a random cyclic
+//     order, as in the scalar rule) and writes it to the intent buffer. Randomness comes from a hash of cell and step.
+//  3. Resolve: every free cell looks at the up to five neighbours that could want it and picks the claimant with the
+//     highest priority (falls first, then a hash of the source cell and step). Losers stay put this step.
+//  4. Commit: winning moves are written into the back buffer, which is swapped in as the new state and mirrored into
+//     the grid (all movers are lifted before any is placed, so the grid ends up equal to the back buffer).
+//Phases 2-4 split the x range across the job system's workers and each piece writes only cells it owns. Obstacle cells
+//enter the snapshot as SOLID_CELL, which counts as taken and never moves.
+
+class IntentResolveRule
+{
+public:
+	enum { NO_INTENT = -1 };
+	//Snapshot values: empty is 0
+	enum { VOXEL_CELL = 1, SOLID_CELL = 2 };
+
+	//Applies one step and returns the number of voxels that moved. Cells obstacles.isSolid() reports are never moved into.
+	template <typename Grid, typename Obstacles>
+	int apply(Grid& grid, unsigned step, const Obstacles& obstacles, JobSystem& jobs)
+	{
+		sizeX = grid.sizeX;
+		sizeY = grid.sizeY;
+		sizeZ = grid.sizeZ;
+		size_t cellCount = (size_t)sizeX * sizeY * sizeZ;
+		if (front.size() != cellCount)
+		{
+			front.assign(cellCount, 0);
+			back.assign(cellCount, 0);
+			intent.assign(cellCount, NO_INTENT);
+			winner.assign(cellCount, NO_INTENT);
+		}
+
+		std::fill(front.begin(), front.end(), 0);
+		for (int x = 0; x < sizeX; x++)
+			for (int y = 0; y < sizeY; y++)
+				for (int z = 0; z < sizeZ; z++)
+					if (obstacles.isSolid(x, y, z))
+						front[index(x, y, z)] = SOLID_CELL;
+		grid.forEachVoxel([&](int x, int y, int z, const voxelPosition&)
+		{
+			front[index(x, y, z)] = VOXEL_CELL;
+		});
+
+		parallelForX(jobs, [&](int x) { writeIntents(x, step); });
+		parallelForX(jobs, [&](int x) { resolveClaims(x, step); });
+		parallelForX(jobs, [&](int x) { copyFront(x); });
+		parallelForX(jobs, [&](int x) { commitWinners(x); });
+
+		//Mirror the committed moves into the grid
+		moves.clear();
+		for (size_t target = 0; target < cellCount; target++)
+			if (winner[target] != NO_INTENT)
+				moves.push_back(std::make_pair(winner[target], (int)target));
+
+		velocities.resize(moves.size());
+		materials.resize(moves.size());
+		for (size_t m = 0; m < moves.size(); m++)
+		{
+			int x, y, z;
+			coords(moves[m].first, x, y, z);
+			const voxelPosition& cell = grid.at(x, y, z);
+			velocities[m] = cell.velocity;
+			materials[m] = cell.material;
+			grid.removeVoxel(x, y, z);
+		}
+		for (size_t m = 0; m < moves.size(); m++)
+		{
+			int x, y, z;
+			coords(moves[m].second, x, y, z);
+			grid.placeVoxel(x, y, z, velocities[m], materials[m]);
+		}
+
+		front.swap(back);
+		return (int)moves.size();
+	}
+
+	//Occupancy after the last step, one byte per cell in x, y, z order (VOXEL_CELL, SOLID_CELL or 0)
+	const std::vector<uint8_t>& occupancy() const { return front; }
+
+	static uint64_t hash(uint64_t value)
+	{
+		value += 0x9E3779B97F4A7C15ull;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+		return value ^ (value >> 31);
+	}
+
+private:
+	int sizeX = 0, sizeY = 0, sizeZ = 0;
+	std::vector<uint8_t> front;
+	std::vector<uint8_t> back;
+	std::vector<int> intent;
+	std::vector<int> winner;
+	std::vector<std::pair<int, int>> moves;
+	std::vector<glm::vec3> velocities;
+	std::vector<uint8_t> materials;
+
+	int index(int x, int y, int z) const { return (x * sizeY + y) * sizeZ + z; }
+
+	void coords(int cell, int& x, int& y, int& z) const
+	{
+		z = cell % sizeZ;
+		y = (cell / sizeZ) % sizeY;
+		x = cell / (sizeZ * sizeY);
+	}
+
+	bool isFree(int x, int y, int z) const
+	{
+		return x >= 0 && y >= 0 && z >= 0 && x < sizeX && y < sizeY && z < sizeZ && !front[index(x, y, z)];
+	}
+
+	static uint64_t cellStepKey(int cell, unsigned step)
+	{
+		return ((uint64_t)step << 32) | (uint32_t)cell;
+	}
+
+	template <typename F>
+	void parallelForX(JobSystem& jobs, F f) const
+	{
+		jobs.parallelFor(0, sizeX, [&](int begin, int end, int)
+		{
+			for (int x = begin; x < end; x++)
+				f(x);
+		});
+	}
+
+	void writeIntents(int x, unsigned step)
+	{
+		//+x, -x, +z, -z, tried cyclically from a random start like the scalar rule
+		static const int sideX[4] = { 1, -1, 0, 0 };
+		static const int sideZ[4] = { 0, 0, 1, -1 };
+
+		for (int y = 0; y < sizeY; y++)
+		{
+			for (int z = 0; z < sizeZ; z++)
+			{
+				int cell = index(x, y, z);
+				intent[cell] = NO_INTENT;
+				if (front[cell] != VOXEL_CELL)
+					continue;
+
+				if (isFree(x, y - 1, z))
+				{
+					intent[cell] = index(x, y - 1, z);
+					continue;
+				}
+
+				int start = (int)(hash(cellStepKey(cell, step)) & 3);
+				for (int n = 0; n < 4; n++)
+				{
+					int side = (start + n) & 3;
+					if (isFree(x + sideX[side], y, z + sideZ[side]))
+					{
+						intent[cell] = index(x + sideX[side], y, z + sideZ[side]);
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	void resolveClaims(int x, unsigned step)
+	{
+		static const int fromX[5] = { 0, 1, -1, 0, 0 };
+		static const int fromY[5] = { 1, 0, 0, 0, 0 };
+		static const int fromZ[5] = { 0, 0, 0, 1, -1 };
+
+		for (int y = 0; y < sizeY; y++)
+		{
+			for (int z = 0; z < sizeZ; z++)
+			{
+				int target = index(x, y, z);
+				winner[target] = NO_INTENT;
+				if (front[target])
+					continue;
+
+				uint64_t bestPriority = 0;
+				for (int n = 0; n < 5; n++)
+				{
+					int sx = x + fromX[n], sy = y + fromY[n], sz = z + fromZ[n];
+					if (sx < 0 || sy < 0 || sz < 0 || sx >= sizeX || sy >= sizeY || sz >= sizeZ)
+						continue;
+					int source = index(sx, sy, sz);
+					if (intent[source] != target)
+						continue;
+
+					//Falling claims (n == 0) always outrank sideways ones
+					uint64_t priority = (hash(cellStepKey(source, step) ^ 0x5bd1e995ull) >> 1) | (n == 0 ? 0x8000000000000000ull : 0);
+					if (winner[target] == NO_INTENT || priority > bestPriority)
+					{
+						bestPriority = priority;
+						winner[target] = source;
+					}
+				}
+			}
+		}
+	}
+
+	void copyFront(int x)
+	{
+		for (int y = 0; y < sizeY; y++)
+			for (int z = 0; z < sizeZ; z++)
+				back[index(x, y, z)] = front[index(x, y, z)];
+	}
+
+	//A source has one intent, so it wins at most one target, and targets were free in the snapshot, so no two threads
+	//write the same back buffer cell
+	void commitWinners(int x)
+	{
+		for (int y = 0; y < sizeY; y++)
+		{
+			for (int z = 0; z < sizeZ; z++)
+			{
+				int target = index(x, y, z);
+				if (winner[target] == NO_INTENT)
+					continue;
+				back[target] = VOXEL_CELL;
+				back[winner[target]] = 0;
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,431 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <vector>
+#include <utility>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <initializer_list>
+
+//One pool of worker threads shared by every parallel stage (simulation rules, instance building, meshing, the CPU ray
+//tracer), so stages don't each start their own threads.
+//
+//Each worker has its own deque. Jobs submitted from a worker go to the back of that worker's deque and the worker takes
+//from the back, so it keeps working on what it just split off while the data is still in cache. An idle worker steals
+//from the front of another worker's deque, which holds the oldest and usually largest pieces of work. The thread that
+//created the pool is worker 0: it has a deque but no thread of its own, and runs jobs while it waits in wait() or
+//parallelFor(). Only one outside thread should wait on a pool at a time.
+//
+//A job can depend on other jobs; it is queued once the last of them finishes. Every job gets the index of the worker
+//running it, which indexes per-worker scratch memory (see WorkerLocal) without locking. Job nodes, deques and
+//parallelFor() reuse their memory, so a steady stream of jobs doesn't allocate as long as the work fits in
+//std::function's inline storage (a couple of pointers).
+
+class JobSystem
+{
+public:
+	struct jobNode;
+
+	//Counted reference to a job. Finished jobs go back to the pool once no handle, queue or dependency refers to them, so
+	//submitting does not allocate once the pool has grown to the number of jobs alive at a time.
+	class JobHandle
+	{
+	public:
+		JobHandle() {}
+		JobHandle(const JobHandle& other) : node(other.node) { if (node) node->references++; }
+		JobHandle(JobHandle&& other) : node(other.node) { other.node = nullptr; }
+		~JobHandle() { release(); }
+
+		JobHandle& operator=(JobHandle other)
+		{
+			std::swap(node, other.node);
+			return *this;
+		}
+
+		explicit operator bool() const { return node != nullptr; }
+		jobNode* operator->() const { return node; }
+
+	private:
+		friend class JobSystem;
+		jobNode* node = nullptr;
+
+		JobHandle(jobNode* job, bool addReference) : node(job) { if (addReference) node->references++; }
+
+		void release()
+		{
+			if (node && --node->references == 0)
+				node->owner->recycle(node);
+			node = nullptr;
+		}
+	};
+
+	struct jobNode
+	{
+		JobSystem* owner = nullptr;
+		std::function<void(int)> work;
+		std::atomic<bool> done{ false };
+		//Unfinished dependencies, plus one held by submit() until every dependency is registered
+		std::atomic<int> waitingOn{ 1 };
+		std::atomic<int> references{ 0 };
+		std::mutex dependentsMutex;
+		std::vector<JobHandle> dependents;
+	};
+
+	struct workerStats
+	{
+		long long jobsRun = 0;
+		//Jobs taken from another worker's deque
+		long long steals = 0;
+		//Time spent finding nothing to run, sleeping or spinning
+		double idleMilliseconds = 0;
+	};
+
+	//workerCount includes the calling thread, so workerCount - 1 threads are started
+	explicit JobSystem(int workerCount) : workers(std::max(1, workerCount))
+	{
+		for (worker& w : workers)
+			w.ring.resize(64);
+		for (int w = 1; w < (int)workers.size(); w++)
+			threads.emplace_back(&JobSystem::workerLoop, this, w);
+	}
+
+	~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	int workerCount() const { return (int)workers.size(); }
+
+	//Index of the calling thread in this pool; threads outside the pool count as worker 0
+	int currentWorker() const
+	{
+		return currentPool() == this ? currentIndex() : 0;
+	}
+
+	//Empty handles among the dependencies are skipped
+	JobHandle submit(std::function<void(int)> work, std::initializer_list<JobHandle> dependencies = {})
+	{
+		return submit(std::move(work), dependencies.begin(), dependencies.end());
+	}
+
+	template <typename Allocator>
+	JobHandle submit(std::function<void(int)> work, const std::vector<JobHandle, Allocator>& dependencies)
+	{
+		return submit(std::move(work), dependencies.data(), dependencies.data() + dependencies.size());
+	}
+
+	//Runs queued jobs on the calling thread until job has finished
+	void wait(const JobHandle& job)
+	{
+		helpUntil([&job]() { return job->done.load(); });
+	}
+
+	//Calls f(rangeBegin, rangeEnd, worker) over [begin, end) in pieces of at most grain and returns once all are done
+	template <typename F>
+	void parallelFor(int begin, int end, int grain, F f)
+	{
+		grain = std::max(1, grain);
+		if (end - begin <= grain || workers.size() == 1)
+		{
+			if (begin < end)
+				f(begin, end, currentWorker());
+			return;
+		}
+
+		//The pieces only point at f and the counter, so each job fits in std::function's inline storage
+		struct loop
+		{
+			F* f;
+			std::atomic<int> remaining;
+		} shared;
+		shared.f = &f;
+		shared.remaining = (end - begin + grain - 1) / grain;
+		loop* context = &shared;
+		for (int pieceBegin = begin; pieceBegin < end; pieceBegin += grain)
+		{
+			int pieceEnd = std::min(end, pieceBegin + grain);
+			submit([context, pieceBegin, pieceEnd](int worker)
+			{
+				(*context->f)(pieceBegin, pieceEnd, worker);
+				context->remaining--;
+			});
+		}
+		helpUntil([&shared]() { return shared.remaining.load() == 0; });
+	}
+
+	//Splits [begin, end) into about 4 pieces per worker, enough to balance uneven work without much overhead
+	template <typename F>
+	void parallelFor(int begin, int end, F f)
+	{
+		int pieces = 4 * (int)workers.size();
+		parallelFor(begin, end, (end - begin + pieces - 1) / pieces, f);
+	}
+
+	std::vector<workerStats> stats() const
+	{
+		std::vector<workerStats> result;
+		for (const worker& w : workers)
+		{
+			std::lock_guard<std::mutex> lock(w.mutex);
+			result.push_back(w.stats);
+		}
+		return result;
+	}
+
+	void resetStats()
+	{
+		for (worker& w : workers)
+		{
+			std::lock_guard<std::mutex> lock(w.mutex);
+			w.stats = workerStats();
+		}
+	}
+
+private:
+	//Deque as a ring buffer that only grows, so queueing doesn't allocate once it is big enough. Each queued job holds a
+	//reference.
+	struct worker
+	{
+		mutable std::mutex mutex;
+		std::vector<jobNode*> ring;
+		size_t head = 0;
+		size_t count = 0;
+		workerStats stats;
+	};
+
+	std::vector<worker> workers;
+	std::vector<std::thread> threads;
+	std::atomic<int> queued{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	//Every node ever made, and the ones free for reuse
+	std::mutex poolMutex;
+	std::vector<std::unique_ptr<jobNode>> nodes;
+	std::vector<jobNode*> freeNodes;
+
+	//Which pool and worker the calling thread belongs to
+	static const JobSystem*& currentPool()
+	{
+		static thread_local const JobSystem* pool = nullptr;
+		return pool;
+	}
+
+	static int& currentIndex()
+	{
+		static thread_local int index = 0;
+		return index;
+	}
+
+	JobHandle submit(std::function<void(int)> work, const JobHandle* firstDependency, const JobHandle* lastDependency)
+	{
+		JobHandle job = allocate();
+		job->work = std::move(work);
+		for (const JobHandle* dependency = firstDependency; dependency != lastDependency; dependency++)
+		{
+			if (!*dependency)
+				continue;
+			std::lock_guard<std::mutex> lock((*dependency)->dependentsMutex);
+			if ((*dependency)->done)
+				continue;
+			job->waitingOn++;
+			(*dependency)->dependents.push_back(job);
+		}
+		if (--job->waitingOn == 0)
+			push(currentWorker(), job.node);
+		return job;
+	}
+
+	JobHandle allocate()
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		if (freeNodes.empty())
+		{
+			nodes.emplace_back(new jobNode());
+			nodes.back()->owner = this;
+			freeNodes.push_back(nodes.back().get());
+		}
+		jobNode* node = freeNodes.back();
+		freeNodes.pop_back();
+		return JobHandle(node, true);
+	}
+
+	//Called by the last reference; dependents was emptied when the job ran and keeps its capacity
+	void recycle(jobNode* node)
+	{
+		node->work = nullptr;
+		node->done = false;
+		node->waitingOn = 1;
+		std::lock_guard<std::mutex> lock(poolMutex);
+		freeNodes.push_back(node);
+	}
+
+	void push(int index, jobNode* job)
+	{
+		job->references++;
+		{
+			worker& w = workers[index];
+			std::lock_guard<std::mutex> lock(w.mutex);
+			if (w.count == w.ring.size())
+			{
+				std::vector<jobNode*> grown(w.ring.size() * 2);
+				for (size_t n = 0; n < w.count; n++)
+					grown[n] = w.ring[(w.head + n) % w.ring.size()];
+				w.ring.swap(grown);
+				w.head = 0;
+			}
+			w.ring[(w.head + w.count) % w.ring.size()] = job;
+			w.count++;
+		}
+		queued++;
+		//Taking the lock orders this with a worker that just found nothing and is about to sleep
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		wake.notify_one();
+	}
+
+	//Newest job from the worker's own deque, otherwise the oldest one from another worker's
+	JobHandle take(int index)
+	{
+		{
+			worker& own = workers[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (own.count > 0)
+			{
+				own.count--;
+				queued--;
+				return JobHandle(own.ring[(own.head + own.count) % own.ring.size()], false);
+			}
+		}
+		for (int n = 1; n < (int)workers.size(); n++)
+		{
+			worker& victim = workers[(index + n) % workers.size()];
+			JobHandle job;
+			{
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (victim.count == 0)
+					continue;
+				job = JobHandle(victim.ring[victim.head], false);
+				victim.head = (victim.head + 1) % victim.ring.size();
+				victim.count--;
+				queued--;
+			}
+			std::lock_guard<std::mutex> lock(workers[index].mutex);
+			workers[index].stats.steals++;
+			return job;
+		}
+		return JobHandle();
+	}
+
+	bool runOne(int index)
+	{
+		JobHandle job = take(index);
+		if (!job)
+			return false;
+
+		job->work(index);
+		job->work = nullptr;
+
+		//No dependent can be added once done is set, so the list can be walked outside the lock
+		{
+			std::lock_guard<std::mutex> lock(job->dependentsMutex);
+			job->done = true;
+		}
+		for (const JobHandle& dependent : job->dependents)
+		{
+			if (--dependent->waitingOn == 0)
+				push(index, dependent.node);
+		}
+		job->dependents.clear();
+
+		std::lock_guard<std::mutex> lock(workers[index].mutex);
+		workers[index].stats.jobsRun++;
+		return true;
+	}
+
+	template <typename Done>
+	void helpUntil(Done done)
+	{
+		int worker = currentWorker();
+		auto idleSince = std::chrono::steady_clock::now();
+		bool idle = false;
+		while (!done())
+		{
+			if (runOne(worker))
+			{
+				if (idle)
+					addIdle(worker, idleSince);
+				idle = false;
+				continue;
+			}
+			if (!idle)
+				idleSince = std::chrono::steady_clock::now();
+			idle = true;
+			std::this_thread::yield();
+		}
+		if (idle)
+			addIdle(worker, idleSince);
+	}
+
+	void addIdle(int index, std::chrono::steady_clock::time_point since)
+	{
+		std::lock_guard<std::mutex> lock(workers[index].mutex);
+		workers[index].stats.idleMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+	}
+
+	void workerLoop(int index)
+	{
+		currentPool() = this;
+		currentIndex() = index;
+		while (true)
+		{
+			if (runOne(index))
+				continue;
+
+			auto idleSince = std::chrono::steady_clock::now();
+			{
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				wake.wait(lock, [this]() { return stopping || queued > 0; });
+				if (stopping)
+					return;
+			}
+			addIdle(index, idleSince);
+		}
+	}
+};
+
+//One T per worker, padded apart so workers writing their own T don't keep invalidating each other's cache lines
+template <typename T>
+class WorkerLocal
+{
+public:
+	explicit WorkerLocal(const JobSystem& jobs) : slots(jobs.workerCount()) {}
+
+	T& operator[](int worker) { return slots[worker].value; }
+	const T& operator[](int worker) const { return slots[worker].value; }
+	int size() const { return (int)slots.size(); }
+
+private:
+	struct slot
+	{
+		T value;
+		char padding[64];
+	};
+	std::vector<slot> slots;
+};
+
+#endif
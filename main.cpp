@@ -2,11 +2,52 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include "shaderHelper.h"
+#include "voxelGrid.h"
+#include "sparseVoxelGrid.h"
+#include "pagedVoxelGrid.h"
+#include "domainDecomposition.h"
+#include "bitboardVoxelGrid.h"
+#include "margolusRule.h"
+#include "intentResolveRule.h"
+#include "densityRule.h"
+#include "voxelTraversal.h"
+#include "jobSystem.h"
+#include "framePipeline.h"
+#include "frameArena.h"
+#include "frameUniforms.h"
+#include "voxelInstance.h"
+#include "occupancyPyramid.h"
+#include "volumeRenderer.h"
+#include "cpuRayTracer.h"
+#include "imageWriter.h"
+#include "surfaceRenderer.h"
+#include "offscreenRenderer.h"
+#include "perfCounters.h"
+#include "simulationEnsemble.h"
+#include "obstacleField.h"
+#include "fluidSources.h"
+#include "instanceBuffer.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <cmath>
 #include <random>
+#include <chrono>
+#include <cstring>
+#include <cctype>
+#include <thread>
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <cstdlib>
+#include <cerrno>
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#endif
+#include <string>
+#include <fstream>
 
 /* Features/Plan:
 	- Basic simulation functionality
@@ -31,86 +72,263 @@ float camRotHorizontal = PI / 6;
 float camRotVertical = PI / 2.5f;
 bool pPressed = false;
 bool oPressed = false;
+bool mPressed = false;
+bool iPressed = false;
+bool lPressed = false;
 
-//Simulation details
+//Simulation details. voxelCount is what fillMatrixRandom spawns and what the instance buffer first has room for;
+//emitters and sinks change the count from there.
 const int voxelCount = 2500;
 const int xSimulationSize = 50;
 const int ySimulationSize = 50;
 const int zSimulationSize = 50;
 const float voxelSpacing = 2;
+static_assert(xSimulationSize <= PACKED_COORD_LIMIT && ySimulationSize <= PACKED_COORD_LIMIT && zSimulationSize <= PACKED_COORD_LIMIT,
+	"instance coordinates are packed into 10 bits per axis");
 
 glm::mat4 projection;
 
-struct vec3Int
+//Grid used by the simulation and the instance builder. See voxelGrid.h for the interface every layout provides.
+//Define VOXEL_LAYOUT_DENSE or VOXEL_LAYOUT_MORTON to build against one of the dense layouts instead of the sparse tree,
+//VOXEL_LAYOUT_PAGED for domains larger than RAM, or VOXEL_LAYOUT_BITBOARD for the word-parallel random rule.
+#if defined(VOXEL_LAYOUT_DENSE)
+typedef DenseVoxelGrid SimulationGrid;
+#elif defined(VOXEL_LAYOUT_MORTON)
+typedef MortonVoxelGrid SimulationGrid;
+#elif defined(VOXEL_LAYOUT_PAGED)
+typedef PagedVoxelGrid SimulationGrid;
+#elif defined(VOXEL_LAYOUT_BITBOARD)
+typedef BitboardVoxelGrid SimulationGrid;
+#else
+typedef SparseVoxelMatrix SimulationGrid;
+#endif
+//The interactive grid keeps an occupancy pyramid current for level of detail
+PyramidTrackedGrid<SimulationGrid> voxelMatrix(xSimulationSize, ySimulationSize, zSimulationSize);
+//Cells the velocity rule moved voxels into during a step of voxelMatrix
+sweptMoveScratch voxelMatrixSwept;
+//Static solids in the interactive grid, empty unless --obstacles is given
+ObstacleField obstacles(xSimulationSize, ySimulationSize, zSimulationSize);
+//Emitters and sinks in the interactive grid, empty unless --sources is given
+FluidSources sources;
+
+//Level of detail: chunks are 16^3 cells (pyramid level 4), and cells are merged until they cover about lodTargetPixels.
+const int lodChunkLevel = 4;
+const float lodTargetPixels = 3.0f;
+
+//Instances built from one simulation step: offsets holds the cells of each level in turn, lodInstanceCount[level] of
+//them starting at lodFirst[level]. offsets is cleared rather than freed between frames, so it only allocates when the
+//voxel count passes its largest so far.
+struct instanceFrame
 {
-	int x = 0;
-	int y = 0;
-	int z = 0;
-	vec3Int();
-	vec3Int(int _x, int _y, int _z)
-	{
-		x = _x;
-		y = _y;
-		z = _z;
-	}
+	std::vector<packedVoxel> offsets;
+	int lodFirst[lodChunkLevel + 1];
+	int lodInstanceCount[lodChunkLevel + 1];
+
+	int instanceCount() const { return lodFirst[lodChunkLevel] + lodInstanceCount[lodChunkLevel]; }
 };
-vec3Int::vec3Int() {}
+//One per frame the pipeline may hold in flight (see framePipeline.h): the workers build the next step into one while
+//the previous one is uploaded and drawn
+const int framesInFlight = 2;
+instanceFrame instanceFrames[framesInFlight];
 
-struct voxelPosition
+//What the CPU stages of a frame read from this thread, captured when the frame is queued
+struct frameInputs
 {
-	bool containsVoxel = false;
-
-	glm::vec3 velocity;
-
-	int rdm = 0;
-
-	voxelPosition();
+	bool stepVelocity = false;
+	bool stepRandom = false;
+	bool stepMargolus = false;
+	bool stepIntent = false;
+	bool stepDensity = false;
+	lodView lod;
 };
 
-voxelPosition::voxelPosition() {}
-
-voxelPosition voxelMatrix[xSimulationSize][ySimulationSize][zSimulationSize];
-float offsetArray[voxelCount * 3];
-
-
-int main()
+//Simulation functions, templated over the grid layout:
+template <typename Grid> int fillOffsetsArray(const Grid& grid, instanceFrame& instances);
+template <typename Grid> void fillOffsetsArrayLod(const PyramidTrackedGrid<Grid>& grid, const lodView& view, instanceFrame& instances, FrameArenas& arenas);
+template <typename Grid> void updateVoxelMatrixRandom(Grid& grid);
+template <typename Grid> void updateVoxelMatrixRandom(Grid& grid, std::mt19937& random);
+template <typename Grid, typename Obstacles> void updateVoxelMatrixRandom(Grid& grid, std::mt19937& random, const Obstacles& obstacles);
+void updateVoxelMatrixRandom(BitboardVoxelGrid& grid);
+void updateVoxelMatrixRandom(BitboardVoxelGrid& grid, std::mt19937& random);
+void updateVoxelMatrixRandom(PyramidTrackedGrid<BitboardVoxelGrid>& grid);
+template <typename Grid, typename Obstacles> void updateVoxelMatrixMargolus(Grid& grid, const Obstacles& obstacles);
+template <typename Grid, typename Obstacles> void updateVoxelMatrixIntent(Grid& grid, const Obstacles& obstacles);
+template <typename Grid, typename Obstacles> void updateVoxelMatrixDensity(Grid& grid, const Obstacles& obstacles);
+void runIntentCheck(int argc, char* argv[]);
+void runDistanceFieldCheck(int argc, char* argv[]);
+void runDensityCheck(int argc, char* argv[]);
+template <typename Grid> void updateVoxelMatrixVelocity(Grid& grid);
+template <typename Grid, typename Obstacles> void updateVoxelMatrixVelocity(Grid& grid, const Obstacles& obstacles, sweptMoveScratch& scratch, sweptMoveStats* stats = nullptr);
+template <typename Grid> void swapVoxelPosition(Grid& grid, vec3Int from, vec3Int to);
+template <typename Grid> void swapVoxelPosition(PyramidTrackedGrid<Grid>& grid, vec3Int from, vec3Int to);
+template <typename Grid> void fillMatrixRandom(Grid& grid);
+void runLayoutBenchmark(int argc, char* argv[]);
+void runLodBenchmark(int argc, char* argv[]);
+void runRaytraceMode(int argc, char* argv[]);
+void runSurfaceBenchmark(int argc, char* argv[]);
+void runSweptBenchmark(int argc, char* argv[]);
+void runDecomposedMode(int argc, char* argv[], bool weakScaling);
+void runEnsembleMode(int argc, char* argv[]);
+std::mt19937& randomGenerator();
+JobSystem& jobSystem();
+void printJobStats(const JobSystem& jobs);
+bool hasFlag(int argc, char* argv[], const char* flag);
+
+
+int main(int argc, char* argv[])
 {
 	//Function prototypes:
 	void framebuffer_size_callback(GLFWwindow * window, int width, int height);
 	void mouseScrollCallback(GLFWwindow * window, double xOffset, double yOffset);
 	void processInput(GLFWwindow * window);
-	void fillOffsetsArray();
-	void updateVoxelMatrixRandom();
-	void updateVoxelMatrixVelocity();
-	void printVoxelMatrixCount();
-	void fillMatrixRandom();
-
-	//Setup GLFW and glad:
-	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	GLFWwindow* window = glfwCreateWindow(800, 600, "Voxels", NULL, NULL);
-	if (window == NULL)
-	{
-		std::cout << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
-		return -1;
+
+	//Headless modes:
+	if (argc > 1 && strcmp(argv[1], "--benchmark-layouts") == 0)
+	{
+		runLayoutBenchmark(argc - 2, argv + 2);
+		return 0;
 	}
-	glfwMakeContextCurrent(window);
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	if (argc > 1 && strcmp(argv[1], "--benchmark-lod") == 0)
 	{
-		std::cout << "Failed to initialize GLAD" << std::endl;
-		return -1;
+		runLodBenchmark(argc - 2, argv + 2);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--raytrace") == 0)
+	{
+		runRaytraceMode(argc - 2, argv + 2);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--benchmark-surface") == 0)
+	{
+		runSurfaceBenchmark(argc - 2, argv + 2);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--benchmark-swept") == 0)
+	{
+		runSweptBenchmark(argc - 2, argv + 2);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--check-intent") == 0)
+	{
+		runIntentCheck(argc - 2, argv + 2);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--check-density") == 0)
+	{
+		runDensityCheck(argc - 2, argv + 2);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--check-distance-field") == 0)
+	{
+		runDistanceFieldCheck(argc - 2, argv + 2);
+		return 0;
+	}
+	if (argc > 1 && (strcmp(argv[1], "--decomposed") == 0 || strcmp(argv[1], "--weak-scaling") == 0))
+	{
+		runDecomposedMode(argc - 2, argv + 2, strcmp(argv[1], "--weak-scaling") == 0);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--ensemble") == 0)
+	{
+		runEnsembleMode(argc - 2, argv + 2);
+		return 0;
 	}
-	glViewport(0, 0, 800, 600);
-	//Input call
-	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-	glfwSetScrollCallback(window, mouseScrollCallback);
 
-	//Setup shader:
-	ShaderHelper defaultShader("defaultVertexShader.vert", "defaultFragmentShader.frag");
+	//--offscreen [frames] [width] [height] [ppm|png|none] renders the same pipeline without a window into a framebuffer
+	//and writes every frame to disk, see offscreenRenderer.h. The flags below still apply.
+	bool offscreen = argc > 1 && strcmp(argv[1], "--offscreen") == 0;
+	int offscreenFrames = 100;
+	int viewWidth = 800;
+	int viewHeight = 600;
+	std::string frameFormat = "ppm";
+	if (offscreen)
+	{
+		//Positional arguments end at the first flag
+		int positional = 2;
+		while (positional < argc && strncmp(argv[positional], "--", 2) != 0)
+			positional++;
+		if (positional > 2) offscreenFrames = std::stoi(argv[2]);
+		if (positional > 3) viewWidth = std::stoi(argv[3]);
+		if (positional > 4) viewHeight = std::stoi(argv[4]);
+		if (positional > 5) frameFormat = argv[5];
+	}
+
+	GLFWwindow* window = NULL;
+	OffscreenContext* offscreenContext = nullptr;
+	FrameCapture* frameCapture = nullptr;
+	if (offscreen)
+	{
+		offscreenContext = new OffscreenContext();
+		if (!offscreenContext->valid)
+		{
+			delete offscreenContext;
+			return -1;
+		}
+		frameCapture = new FrameCapture(viewWidth, viewHeight, frameFormat);
+		//Nothing to hold keys down, so step the random rule as if O were held, or the density rule as if L were
+		if (hasFlag(argc, argv, "--density"))
+			lPressed = true;
+		else
+			oPressed = true;
+	}
+	else
+	{
+		//Setup GLFW and glad:
+		glfwInit();
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		window = glfwCreateWindow(viewWidth, viewHeight, "Voxels", NULL, NULL);
+		if (window == NULL)
+		{
+			std::cout << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
+			return -1;
+		}
+		glfwMakeContextCurrent(window);
+		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+		{
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return -1;
+		}
+		glViewport(0, 0, viewWidth, viewHeight);
+		//Input call
+		glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+		glfwSetScrollCallback(window, mouseScrollCallback);
+	}
+	//GLFW's clock only runs once it is initialised
+	auto programStart = std::chrono::steady_clock::now();
+	auto elapsedSeconds = [&]() { return offscreen ? std::chrono::duration<double>(std::chrono::steady_clock::now() - programStart).count() : glfwGetTime(); };
+
+	//Setup shader (sources are watched and relinked on change; --no-shader-cache forces a compile from source).
+	//--vertex-pulling draws from a storage buffer of packed cells with glDrawArrays instead of instancing.
+	//--no-lod draws every voxel at full detail. --volume ray-marches a 3D occupancy texture instead of drawing cubes.
+	//--surface draws a smooth surface extracted from the occupancy instead of cubes.
+	//--no-pipeline steps, builds and draws each frame in turn instead of stepping the next frame while one is drawn.
+	//--obstacles <file> loads static solids the fluid flows around (see obstacleField.h). Every rule keeps out of them;
+	//the bitboard kernel doesn't know about them, so the random rule runs voxel by voxel while they are loaded.
+	//--sources <file> loads emitters and sinks that add and remove fluid every step (see fluidSources.h).
+	//--density steps the multi-material density rule in offscreen runs instead of the random rule (see densityRule.h).
+	bool useShaderCache = !hasFlag(argc, argv, "--no-shader-cache");
+	bool vertexPulling = hasFlag(argc, argv, "--vertex-pulling");
+	bool levelOfDetail = !hasFlag(argc, argv, "--no-lod");
+	bool volumeRendering = hasFlag(argc, argv, "--volume");
+	bool surfaceRendering = hasFlag(argc, argv, "--surface");
+	const char* obstaclePath = nullptr;
+	const char* sourcePath = nullptr;
+	for (int a = 1; a + 1 < argc; a++)
+	{
+		if (strcmp(argv[a], "--obstacles") == 0)
+			obstaclePath = argv[a + 1];
+		else if (strcmp(argv[a], "--sources") == 0)
+			sourcePath = argv[a + 1];
+	}
+	//The volume and surface uploads read the grid on this thread, so they can't overlap the next step
+	bool pipelined = !hasFlag(argc, argv, "--no-pipeline") && !volumeRendering && !surfaceRendering;
+	ShaderHelper defaultShader(vertexPulling ? "vertexPullingShader.vert" : "defaultVertexShader.vert", "defaultFragmentShader.frag", true, useShaderCache);
 	defaultShader.use();
+	std::cout << "Shader program ready in " << defaultShader.buildMilliseconds << " ms ("
+		<< (defaultShader.loadedFromCache ? "binary cache" : "compiled from source") << ")" << std::endl;
 
 #pragma region
 
@@ -161,15 +379,30 @@ int main()
 
 	//Data in this array is tightly packed.
 
-	//fillMatrixRandom();
+	//fillMatrixRandom(voxelMatrix);
 	
 	for (int i = 0; i < xSimulationSize; i++)
 	{
 		for (int j = 0; j < ySimulationSize; j++)
 		{
-			voxelMatrix[i][j][0].containsVoxel = true;
+			voxelMatrix.placeVoxel(i, j, 0);
 		}
 	}
+
+	if (obstaclePath && obstacles.load(obstaclePath))
+	{
+		obstacles.buildDistanceField(jobSystem());
+		//Fluid placed where an obstacle is would be stuck inside it
+		for (int i = 0; i < xSimulationSize; i++)
+			for (int j = 0; j < ySimulationSize; j++)
+				for (int k = 0; k < zSimulationSize; k++)
+					if (obstacles.isSolid(i, j, k) && voxelMatrix.containsVoxel(i, j, k))
+						voxelMatrix.removeVoxel(i, j, k);
+		std::cout << "Obstacles: " << obstacles.solidCellCount() << " solid cells, distance field in " << obstacles.buildMilliseconds << " ms ("
+			<< obstacles.sweepCount << " sweeps)" << std::endl;
+	}
+	if (sourcePath && sources.load(sourcePath))
+		std::cout << "Sources: " << sources.emitterCount() << " emitter(s), " << sources.sinkCount() << " sink(s)" << std::endl;
 	
 
 	//fillOffsetsArray(voxelMatrix, offsetArray);
@@ -191,18 +424,21 @@ int main()
 	float matrixCenterY = (ySimulationSize * voxelSpacing) / 2.0f;
 	float matrixCenterZ = (zSimulationSize * voxelSpacing) / 2.0f;
 
-	//perspective project matrix with fov 45, aspect ration 4:3, near and far plane 0.1 and 1000
-	projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+	//perspective project matrix with fov 45, aspect ratio of the window or frames, near and far plane 0.1 and 1000
+	projection = glm::perspective(glm::radians(45.0f), (float)viewWidth / viewHeight, 0.1f, 1000.0f);
 
-	//Assign matrices to vertex shader
-	int modelUniformLoc = glGetUniformLocation(defaultShader.ID, "modelToWorld");
-	glUniformMatrix4fv(modelUniformLoc, 1, GL_FALSE, glm::value_ptr(modelToWorld));
+	//Assign matrices to vertex shader. View and projection are per-frame state shared by all programs through the UBO.
+	defaultShader.setMat4("modelToWorld", modelToWorld);
+	defaultShader.setFloat("voxelSpacing", voxelSpacing);
 
-	int viewLoc = glGetUniformLocation(defaultShader.ID, "view");
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+	FrameUniformBuffer frameBuffer;
+	defaultShader.bindUniformBlock("FrameData", FrameUniformBuffer::BINDING);
+	frameUniforms frameData;
+	frameData.projection = projection;
 
-	int projectionLoc = glGetUniformLocation(defaultShader.ID, "projection");
-	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+	VolumeRenderer* volume = volumeRendering ? new VolumeRenderer(xSimulationSize, ySimulationSize, zSimulationSize, useShaderCache) : nullptr;
+	SurfaceRenderer* surface = surfaceRendering ? new SurfaceRenderer(xSimulationSize, ySimulationSize, zSimulationSize, voxelSpacing,
+		jobSystem(), useShaderCache) : nullptr;
 
 #pragma endregion Vertex Shader Matrices
 
@@ -210,33 +446,67 @@ int main()
 
 	//Setup draw elements/data:
 
-	//Generate and bind VAO
+	//Generate and bind VAO (the vertex puller reads no attributes, but the core profile still needs one bound)
 	unsigned int VAO;
 	glGenVertexArrays(1, &VAO);
 	glBindVertexArray(VAO);
 
-	//Generate and bind VBO for voxel
-	unsigned int VBO;
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cubeLocalVertices), cubeLocalVertices, GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-
-	//Generate and bind EBO for voxel
-	unsigned int EBO;
-	glGenBuffers(1, &EBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeTriIndices), cubeTriIndices, GL_STATIC_DRAW);
-
-	//Create VBO for instanced offsets array
-	unsigned int offsetVBO;
-	glGenBuffers(1, &offsetVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, offsetVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * voxelCount * 3, &offsetArray[0], GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-	glVertexAttribDivisor(1, 1);
-	glEnableVertexAttribArray(1);
+	//Packed cell coordinates, one per voxel (see voxelInstance.h). An instanced vertex attribute normally, the storage
+	//buffer the vertex shader indexes with vertex pulling. It grows with the voxel count, see instanceBuffer.h.
+	const GLenum offsetTarget = vertexPulling ? GL_SHADER_STORAGE_BUFFER : GL_ARRAY_BUFFER;
+	InstanceBuffer offsetBuffer(offsetTarget, sizeof(packedVoxel) * voxelCount);
+	unsigned int offsetVBO = offsetBuffer.name();
+
+	unsigned int VBO = 0;
+	unsigned int EBO = 0;
+	if (vertexPulling)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, offsetVBO);
+	}
+	else
+	{
+		glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(packedVoxel), (void*)0);
+		glVertexAttribDivisor(1, 1);
+		glEnableVertexAttribArray(1);
+
+		//Generate and bind VBO for voxel
+		glGenBuffers(1, &VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(cubeLocalVertices), cubeLocalVertices, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+
+		//Generate and bind EBO for voxel
+		glGenBuffers(1, &EBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeTriIndices), cubeTriIndices, GL_STATIC_DRAW);
+	}
+
+	//Obstacles never change, so their cells go into a buffer of their own, uploaded once. Instancing needs a second
+	//VAO reading it; the vertex puller just binds it in place of the voxel buffer while drawing them.
+	std::vector<packedVoxel> obstacleCells = obstacles.visibleCells();
+	unsigned int obstacleVAO = VAO;
+	unsigned int obstacleVBO = 0;
+	if (!obstacleCells.empty())
+	{
+		glGenBuffers(1, &obstacleVBO);
+		glBindBuffer(offsetTarget, obstacleVBO);
+		glBufferData(offsetTarget, sizeof(packedVoxel) * obstacleCells.size(), obstacleCells.data(), GL_STATIC_DRAW);
+		if (!vertexPulling)
+		{
+			glGenVertexArrays(1, &obstacleVAO);
+			glBindVertexArray(obstacleVAO);
+			glBindBuffer(GL_ARRAY_BUFFER, VBO);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+			glEnableVertexAttribArray(0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			glBindBuffer(GL_ARRAY_BUFFER, obstacleVBO);
+			glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(packedVoxel), (void*)0);
+			glVertexAttribDivisor(1, 1);
+			glEnableVertexAttribArray(1);
+			glBindVertexArray(VAO);
+		}
+	}
 
 #pragma endregion Make Draw Elements
 
@@ -245,12 +515,65 @@ int main()
 	//Depth Testing
 	glEnable(GL_DEPTH_TEST);
 	//Vsync
-	glfwSwapInterval(1);
-	while (!glfwWindowShouldClose(window))
+	if (!offscreen)
+		glfwSwapInterval(1);
+	FramePipeline<frameInputs> pipeline(jobSystem(), pipelined ? framesInFlight : 1, [](const frameInputs& inputs)
+	{
+		if (inputs.stepVelocity)
+			updateVoxelMatrixVelocity(voxelMatrix, obstacles, voxelMatrixSwept);
+		else if (inputs.stepRandom && obstacles.empty())
+			updateVoxelMatrixRandom(voxelMatrix);
+		//The bitboard word kernel can't see obstacles, so with them every layout takes the voxel by voxel rule
+		else if (inputs.stepRandom)
+			updateVoxelMatrixRandom(voxelMatrix, randomGenerator(), obstacles);
+		else if (inputs.stepMargolus)
+			updateVoxelMatrixMargolus(voxelMatrix, obstacles);
+		else if (inputs.stepIntent)
+			updateVoxelMatrixIntent(voxelMatrix, obstacles);
+		else if (inputs.stepDensity)
+			updateVoxelMatrixDensity(voxelMatrix, obstacles);
+
+		//Sources run with whichever rule is stepping, and not while the simulation is paused
+		bool stepped = inputs.stepVelocity || inputs.stepRandom || inputs.stepMargolus || inputs.stepIntent || inputs.stepDensity;
+		if (stepped && !sources.empty())
+			sources.apply(voxelMatrix, obstacles, randomGenerator());
+	}, [=](const frameInputs& inputs, int slot, FrameArenas& arenas)
+	{
+		if (volumeRendering || surfaceRendering)
+			return;
+		if (levelOfDetail)
+			fillOffsetsArrayLod(voxelMatrix, inputs.lod, instanceFrames[slot], arenas);
+		else
+			fillOffsetsArray(voxelMatrix, instanceFrames[slot]);
+	});
+	//Heap allocations made while the second half of the frames ran (see frameArena.h), which should be none
+	long long steadyAllocations = 0;
+	double lastShaderCheck = elapsedSeconds();
+	double lastSurfaceReport = elapsedSeconds();
+	auto loopStart = std::chrono::steady_clock::now();
+	int frame = 0;
+	while (offscreen ? frame < offscreenFrames : !glfwWindowShouldClose(window))
 	{
+		long long allocationsBefore = heapAllocationCount();
+
 		//Input and Events:
-		processInput(window);
-		glfwPollEvents();
+		if (!offscreen)
+		{
+			processInput(window);
+			glfwPollEvents();
+		}
+
+		//Relink the shader if its sources changed; uniforms are per program, so reapply them
+		if (elapsedSeconds() - lastShaderCheck > 0.5)
+		{
+			lastShaderCheck = elapsedSeconds();
+			if (defaultShader.reloadIfChanged())
+			{
+				defaultShader.use();
+				defaultShader.setMat4("modelToWorld", modelToWorld);
+				defaultShader.setFloat("voxelSpacing", voxelSpacing);
+			}
+		}
 
 		//Update Camera matrix:
 		float camPosX = (camDistance * sin(camRotHorizontal) * sin(camRotVertical)) + matrixCenterX;
@@ -260,43 +583,186 @@ int main()
 		view = glm::lookAt(glm::vec3(camPosX, camPosY, camPosZ),     //Position
 						   glm::vec3(matrixCenterX, matrixCenterY, matrixCenterZ),   //Target Position
 						   glm::vec3(0.0f, 1.0f, 0.0f));							 //Up 
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-		//Update Simulation
-		if (pPressed)
+		frameData.view = view;
+		frameData.viewProjection = projection * view;
+		frameData.cameraPosition = glm::vec3(camPosX, camPosY, camPosZ);
+		frameData.time = (float)elapsedSeconds();
+		frameData.inverseViewProjection = glm::inverse(frameData.viewProjection);
+		frameBuffer.update(frameData);
+
+		//Queue the next simulation step and the instances built from it. Keys and camera are read now, as the jobs may
+		//run while this thread is drawing.
+		frameInputs inputs;
+		inputs.stepVelocity = pPressed;
+		inputs.stepRandom = oPressed;
+		inputs.stepMargolus = mPressed;
+		inputs.stepIntent = iPressed;
+		inputs.stepDensity = lPressed;
+		inputs.lod.cameraPosition = glm::vec3(camPosX, camPosY, camPosZ);
+		inputs.lod.voxelSpacing = voxelSpacing;
+		inputs.lod.pixelsPerUnit = viewHeight / (2.0f * tan(glm::radians(45.0f) / 2.0f));
+		inputs.lod.targetPixels = lodTargetPixels;
+		inputs.lod.chunkLevel = lodChunkLevel;
+		pipeline.submit(inputs);
+
+		//Fill the pipeline before drawing; the first framesInFlight - 1 iterations only queue work
+		if (!pipeline.full())
+			continue;
+		const instanceFrame& instances = instanceFrames[pipeline.waitOldest()];
+
+		//Upload the offset array (instanced array), or the occupancy textures when ray marching
+		if (volumeRendering)
 		{
-			updateVoxelMatrixVelocity();
+			volume->upload(voxelMatrix);
 		}
-		else if (oPressed)
+		else if (surfaceRendering)
 		{
-			updateVoxelMatrixRandom();
+			surface->upload(voxelMatrix, pipeline.arenas().current());
+			if (elapsedSeconds() - lastSurfaceReport > 2.0)
+			{
+				lastSurfaceReport = elapsedSeconds();
+				std::cout << "Surface: " << surface->mesher.triangleCount() << " triangles, " << surface->mesher.lastUpdateMilliseconds << " ms meshing ("
+					<< surface->mesher.lastRemeshedChunks << "/" << surface->mesher.totalChunks() << " chunks)" << std::endl;
+			}
+		}
+		else
+		{
+			offsetBuffer.upload(instances.offsets.data(), sizeof(packedVoxel) * instances.instanceCount());
 		}
-
-		//Update offset array (instanced array)
-		fillOffsetsArray();
-		glBindBuffer(GL_ARRAY_BUFFER, offsetVBO);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * voxelCount * 3, &offsetArray[0]);
 
 		//Clear Screen and depth buffer:
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT);
 
-		//Draw objects
-		glBindVertexArray(VAO);
-		glDrawElementsInstanced(GL_TRIANGLES, voxelCount * 36, GL_UNSIGNED_INT, 0, voxelCount);
+		//Draw objects, the obstacles first from their static buffer
+		if (!obstacleCells.empty())
+		{
+			defaultShader.use();
+			defaultShader.setInt("lodLevel", 0);
+			defaultShader.setInt("obstaclePass", 1);
+			glBindVertexArray(obstacleVAO);
+			if (vertexPulling)
+			{
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, obstacleVBO);
+				glDrawArrays(GL_TRIANGLES, 0, (GLsizei)obstacleCells.size() * 36);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, offsetVBO);
+			}
+			else
+			{
+				glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, (GLsizei)obstacleCells.size());
+			}
+			defaultShader.setInt("obstaclePass", 0);
+		}
+		if (volumeRendering)
+		{
+			volume->draw(voxelSpacing);
+		}
+		else if (surfaceRendering)
+		{
+			surface->draw(modelToWorld);
+		}
+		else
+		{
+			glBindVertexArray(VAO);
+			for (int level = 0; level <= lodChunkLevel; level++)
+			{
+				if (instances.lodInstanceCount[level] == 0)
+					continue;
+				defaultShader.setInt("lodLevel", level);
+				if (vertexPulling)
+					glDrawArrays(GL_TRIANGLES, instances.lodFirst[level] * 36, instances.lodInstanceCount[level] * 36);
+				else
+					glDrawElementsInstancedBaseInstance(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, instances.lodInstanceCount[level], instances.lodFirst[level]);
+			}
+		}
+
+		//The slot is free again: the draw reads the buffer object, not the array
+		pipeline.retire();
+		//Readback and file writing happen below, on their own thread, and are left out
+		if (frame >= offscreenFrames / 2)
+			steadyAllocations += heapAllocationCount() - allocationsBefore;
 
 		//Events and Buffers:
-		glfwSwapBuffers(window);
+		if (offscreen)
+			frameCapture->capture();
+		else
+			glfwSwapBuffers(window);
+		frame++;
+	}
+
+	pipeline.drain();
+	if (offscreen)
+	{
+		frameCapture->finish();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStart).count();
+		std::cout << frame << " frames at " << viewWidth << "x" << viewHeight << " in " << seconds << " s: " << frame / seconds << " fps, "
+			<< frameCapture->waitMilliseconds / frame << " ms/frame waiting on readback and writes" << std::endl;
+		std::cout << pipeline.framesInFlight() << " frame(s) in flight: " << pipeline.simulateMilliseconds / frame << " ms/frame simulating, "
+			<< pipeline.buildMilliseconds / frame << " ms/frame building instances, " << pipeline.waitMilliseconds / frame
+			<< " ms/frame waiting on them" << std::endl;
+		std::cout << instanceFrames[0].offsets.capacity() << " instances fit the CPU array, " << (offsetBuffer.capacityBytes() >> 10) << " KB instance buffer after "
+			<< offsetBuffer.reallocationCount() << " reallocation(s)";
+		if (!sources.empty())
+			std::cout << ", " << sources.spawned << " voxels emitted and " << sources.drained << " drained";
+		std::cout << std::endl;
+		std::cout << (pipeline.arenas().highWaterBytes() >> 10) << " KB frame arena high water (" << (pipeline.arenas().capacityBytes() >> 10)
+			<< " KB reserved, " << pipeline.arenas().overflowCount() << " overflows)";
+#if defined(COUNT_HEAP_ALLOCATIONS)
+		std::cout << ", " << steadyAllocations << " heap allocations in the last " << frame - offscreenFrames / 2 << " frames";
+#endif
+		std::cout << std::endl;
 	}
 
-	glfwTerminate();
+	delete volume;
+	delete surface;
+	if (offscreen)
+	{
+		delete frameCapture;
+		delete offscreenContext;
+	}
+	else
+	{
+		glfwTerminate();
+	}
 	return 0;
 }
 
 
+#if defined(COUNT_HEAP_ALLOCATIONS)
+//Counts every allocation made through new for heapAllocationCount() (see frameArena.h), with the deletes that match it.
+//The array and nothrow forms forward to these by default, so they stay paired too. GCC still warns where it inlines
+//free() into a caller whose pointer came from new, not seeing that this new is malloc().
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(size_t size)
+{
+	heapAllocationCount()++;
+	void* memory = malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
+
 //Randomly fills the voxel matrix with a voxelCount/matrixSize chance to generate a voxel at each location.
-void fillMatrixRandom()
+template <typename Grid>
+void fillMatrixRandom(Grid& grid)
 {
 	int randomIntInRange(int min, int max);
 	int voxelsSpawned = 0;
@@ -307,13 +773,13 @@ void fillMatrixRandom()
 
 	while (voxelsSpawned < voxelCount)
 	{
-		chosenX = randomIntInRange(0, xSimulationSize - 1);
-		chosenY = randomIntInRange(0, ySimulationSize - 1);
-		chosenZ = randomIntInRange(0, zSimulationSize - 1);
+		chosenX = randomIntInRange(0, grid.sizeX - 1);
+		chosenY = randomIntInRange(0, grid.sizeY - 1);
+		chosenZ = randomIntInRange(0, grid.sizeZ - 1);
 
-		if (!voxelMatrix[chosenX][chosenY][chosenZ].containsVoxel)
+		if (!grid.containsVoxel(chosenX, chosenY, chosenZ))
 		{
-			voxelMatrix[chosenX][chosenY][chosenZ].containsVoxel = true;
+			grid.placeVoxel(chosenX, chosenY, chosenZ);
 			voxelsSpawned++;
 		}
 	}
@@ -321,171 +787,1242 @@ void fillMatrixRandom()
 
 //Min and max inclusive
 int randomIntInRange(int min, int max) 
+{
+	std::uniform_int_distribution<int> dis(min, max);
+	return dis(randomGenerator());
+}
+
+//Shared generator behind randomIntInRange, exposed so forked ranks can reseed it
+std::mt19937& randomGenerator()
 {
 	static std::random_device rd;
 	static std::mt19937 gen(rd());
-	std::uniform_int_distribution<int> dis(min, max);
-	return dis(gen);
+	return gen;
+}
+
+//Worker pool shared by the parallel rules, instance building and meshing, one worker per hardware thread
+JobSystem& jobSystem()
+{
+	static JobSystem jobs(std::max(1u, std::thread::hardware_concurrency()));
+	return jobs;
+}
+
+void printJobStats(const JobSystem& jobs)
+{
+	std::vector<JobSystem::workerStats> stats = jobs.stats();
+	for (size_t w = 0; w < stats.size(); w++)
+	{
+		std::cout << "  worker " << w << ": " << stats[w].jobsRun << " jobs, " << stats[w].steals << " steals, "
+			<< stats[w].idleMilliseconds << " ms idle" << std::endl;
+	}
 }
 
-void swapVoxelPosition(vec3Int from, vec3Int to)
+template <typename Grid>
+void swapVoxelPosition(Grid& grid, vec3Int from, vec3Int to)
 {
-	voxelMatrix[to.x][to.y][to.z].containsVoxel = true;
-	voxelMatrix[to.x][to.y][to.z].velocity = voxelMatrix[from.x][from.y][from.z].velocity;
+	voxelPosition cell = grid.at(from.x, from.y, from.z);
+	grid.placeVoxel(to.x, to.y, to.z, cell.velocity, cell.material);
 
-	voxelMatrix[from.x][from.y][from.z] = voxelPosition();
+	grid.removeVoxel(from.x, from.y, from.z);
+}
+
+//Tracked grids update the pyramid once for the move instead of once each for the place and the removal
+template <typename Grid>
+void swapVoxelPosition(PyramidTrackedGrid<Grid>& grid, vec3Int from, vec3Int to)
+{
+	grid.moveVoxel(from, to);
+}
+
+//Level L > 0 of the largest aligned cube of 2^L cells holding (x, y, z) known to hold no voxel but the one in from, or
+//0. Untracked grids can't tell.
+template <typename Grid>
+int emptyCubeLevel(const Grid&, vec3Int, int, int, int)
+{
+	return 0;
+}
+
+//Climbs the pyramid from (x, y, z) while its cells hold only the mover, stopping at cubes that overhang the grid, whose
+//cells outside it the walk must still see as blocked
+template <typename Grid>
+int emptyCubeLevel(const PyramidTrackedGrid<Grid>& grid, vec3Int from, int x, int y, int z)
+{
+	const OccupancyPyramid& pyramid = grid.pyramid();
+	int found = 0;
+	for (int level = 1; level < pyramid.levelCount(); level++)
+	{
+		int cx = x >> level, cy = y >> level, cz = z >> level;
+		if (((cx + 1) << level) > grid.sizeX || ((cy + 1) << level) > grid.sizeY || ((cz + 1) << level) > grid.sizeZ)
+			break;
+		uint32_t mover = (from.x >> level) == cx && (from.y >> level) == cy && (from.z >> level) == cz ? 1 : 0;
+		if (pyramid.count(level, cx, cy, cz) != mover)
+			break;
+		found = level;
+	}
+	return found;
 }
 
 //Performs a single simulation step on the voxel matrix
-void updateVoxelMatrixVelocity()
+template <typename Grid>
+void updateVoxelMatrixVelocity(Grid& grid)
+{
+	sweptMoveScratch scratch;
+	updateVoxelMatrixVelocity(grid, noObstacles(), scratch);
+}
+
+//Same step with static obstacles (see obstacleField.h). Each voxel moves along its velocity cell by cell with the DDA
+//in voxelTraversal.h and stops in the last free cell before one that is taken, solid or outside the grid, keeping its
+//position inside the cell so slow velocities still add up. Moves that end in the cell they started in skip the walk, and
+//the walk jumps cubes of cells the occupancy pyramid and the obstacle distance field show to be empty, so a long move
+//through open space costs a few lookups. Adds what it did to stats.
+//The sweep reaches a voxel again if it moves ahead in sweep order, so cells moved into are marked and skipped until the
+//step ends, in scratch, which belongs to this grid.
+template <typename Grid, typename Obstacles>
+void updateVoxelMatrixVelocity(Grid& grid, const Obstacles& obstacles, sweptMoveScratch& scratch, sweptMoveStats* stats)
 {
 	int gravity = 1.0f;
-	vec3Int desiredPos;
-	glm::vec3 vel;
+	sweptMoveStats counted;
+	auto isInside = [&](int x, int y, int z) { return x >= 0 && y >= 0 && z >= 0 && x < grid.sizeX && y < grid.sizeY && z < grid.sizeZ; };
+	auto isBlocked = [&](int x, int y, int z) { return !isInside(x, y, z) || grid.containsVoxel(x, y, z) || obstacles.isSolid(x, y, z); };
 
-	for (int i = 0; i < xSimulationSize; i++)
+	scratch.begin((size_t)grid.sizeX * grid.sizeY * grid.sizeZ);
+	auto cellIndex = [&](int x, int y, int z) { return ((size_t)x * grid.sizeY + y) * grid.sizeZ + z; };
+
+	grid.sweep([&](int i, int j, int k)
 	{
-		for (int j = 0; j < ySimulationSize; j++)
+		if (scratch.arrived(cellIndex(i, j, k)))
+			return;
+		voxelPosition& cell = grid.at(i, j, k);
+		cell.velocity.z += gravity;
+		counted.voxels++;
+
+		glm::vec3 start = subcellPosition(cell, i, j, k);
+		glm::vec3 end = start + cell.velocity;
+		vec3Int target((int)std::floor(end.x), (int)std::floor(end.y), (int)std::floor(end.z));
+		if (target.x == i && target.y == j && target.z == k)
+		{
+			storeSubcellPosition(cell, end, i, j, k);
+			counted.withinCell++;
+			return;
+		}
+		//The walk looks up other cells, which on a paged grid can evict this one's chunk and leave cell dangling, so only
+		//a copy of the velocity is used from here and the cell is looked up again to write it back
+		glm::vec3 velocity = cell.velocity;
+
+		auto emptyCube = [&](int x, int y, int z)
+		{
+			int level = emptyCubeLevel(grid, vec3Int(i, j, k), x, y, z);
+			while (level > 0 && !obstacles.cubeClear((x >> level) << level, (y >> level) << level, (z >> level) << level, 1 << level))
+				level--;
+			return level;
+		};
+		traversalResult path = traverseCells(start, velocity, isBlocked, emptyCube);
+		counted.walked++;
+		counted.cellsVisited += path.cellsVisited;
+		counted.blocksSkipped += path.blocksSkipped;
+
+		if (path.blocked)
 		{
-			for (int k = 0; k < zSimulationSize; k++)
+			counted.blocked++;
+			vec3Int hit = path.blockedCell;
+			glm::vec3 vel = velocity;
+			//Another voxel: half velocity and flip
+			if (isInside(hit.x, hit.y, hit.z) && grid.containsVoxel(hit.x, hit.y, hit.z))
 			{
-				if (voxelMatrix[i][j][k].containsVoxel)
-				{
-					voxelMatrix[i][j][k].velocity.z += gravity;
-
-					vel = voxelMatrix[i][j][k].velocity;
-					desiredPos = vec3Int(vel.x + i, vel.y + j, vel.z + k);
-
-					//If desired position is empty, move there
-					if (!voxelMatrix[desiredPos.x][desiredPos.y][desiredPos.z].containsVoxel)
-					{
-						swapVoxelPosition(vec3Int(i, j, k), vec3Int(desiredPos.x, desiredPos.y, desiredPos.z));
-					}
-					//Else half velocity and flip
-					else
-					{
-						voxelMatrix[i][j][k].velocity.x = -(vel.x / 2);
-						voxelMatrix[i][j][k].velocity.y = -(vel.y / 2);
-						voxelMatrix[i][j][k].velocity.z = -(vel.z / 2);
-					}
-				}
+				velocity = -vel / 2.0f;
+			}
+			//A wall or obstacle: the part of the velocity going into it is reflected and halved, about the normal of the
+			//distance field where it has one and of the face the walk hit otherwise
+			else
+			{
+				glm::vec3 normal = obstacles.normal(path.cell.x, path.cell.y, path.cell.z);
+				if (glm::dot(normal, path.normal) <= 0)
+					normal = path.normal;
+				float into = glm::dot(vel, normal);
+				velocity = into < 0 ? vel - 1.5f * into * normal : -vel / 2.0f;
 			}
 		}
+
+		grid.at(i, j, k).velocity = velocity;
+		if (path.cell.x == i && path.cell.y == j && path.cell.z == k)
+		{
+			storeSubcellPosition(grid.at(i, j, k), path.position, i, j, k);
+		}
+		else
+		{
+			swapVoxelPosition(grid, vec3Int(i, j, k), path.cell);
+			storeSubcellPosition(grid.at(path.cell.x, path.cell.y, path.cell.z), path.position, path.cell.x, path.cell.y, path.cell.z);
+			scratch.markArrived(cellIndex(path.cell.x, path.cell.y, path.cell.z));
+		}
+	});
+
+	if (stats)
+	{
+		stats->voxels += counted.voxels;
+		stats->withinCell += counted.withinCell;
+		stats->walked += counted.walked;
+		stats->cellsVisited += counted.cellsVisited;
+		stats->blocksSkipped += counted.blocksSkipped;
+		stats->blocked += counted.blocked;
 	}
 }
 
 //Performs a single simulation step on the voxel matrix
-void updateVoxelMatrixRandom()
+template <typename Grid>
+void updateVoxelMatrixRandom(Grid& grid)
+{
+	updateVoxelMatrixRandom(grid, randomGenerator());
+}
+
+//Same step drawing from the given generator, so independent simulations can step on different threads
+template <typename Grid>
+void updateVoxelMatrixRandom(Grid& grid, std::mt19937& random)
+{
+	updateVoxelMatrixRandom(grid, random, noObstacles());
+}
+
+//Same step with static obstacles, whose cells count as taken
+template <typename Grid, typename Obstacles>
+void updateVoxelMatrixRandom(Grid& grid, std::mt19937& random, const Obstacles& obstacles)
 {
 	int rdm = 0;
+	std::uniform_int_distribution<int> direction(0, 3);
+	auto isFree = [&](int x, int y, int z) { return !grid.containsVoxel(x, y, z) && !obstacles.isSolid(x, y, z); };
 
-	for (int i = 0; i < xSimulationSize; i++)
+	grid.sweep([&](int i, int j, int k)
 	{
-		for (int j = 0; j < ySimulationSize; j++)
+		//Pick random direction to start sampling +x, -x, +y, -y
+		rdm = direction(random);
+
+		//Move down if none beneath and not at floor
+		if (j > 0 && isFree(i, j - 1, k))
+		{
+			swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j - 1, k));
+		}
+		//+x
+		else if (rdm == 0)
+		{
+			if(i < grid.sizeX - 1 && isFree(i + 1, j, k))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i + 1, j, k));
+
+			//-x
+			else if(i > 0 && isFree(i - 1, j, k))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i - 1, j, k));
+			//+y
+			else if(k < grid.sizeZ - 1 && isFree(i, j, k + 1))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j, k + 1));
+			//-y
+			else if(k > 0 && isFree(i, j, k - 1))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j, k - 1));
+		}
+		//-x
+		else if (rdm == 1)
+		{
+			if(i > 0 && isFree(i - 1, j, k))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i - 1, j, k));
+
+			//+y
+			else if (k < grid.sizeZ - 1 && isFree(i, j, k + 1))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j, k + 1));
+			//-y
+			else if (k > 0 && isFree(i, j, k - 1))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j, k - 1));
+			//+x
+			else if (i < grid.sizeX - 1 && isFree(i + 1, j, k))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i + 1, j, k));
+		}
+		//+y
+		else if (rdm == 2)
+		{
+			if(k < grid.sizeZ - 1 && isFree(i, j, k + 1))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j, k + 1));
+
+			//-y
+			else if (k > 0 && isFree(i, j, k - 1))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j, k - 1));
+			//+x
+			else if (i < grid.sizeX - 1 && isFree(i + 1, j, k))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i + 1, j, k));
+			//-x
+			else if (i > 0 && isFree(i - 1, j, k))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i - 1, j, k));
+		}
+		//-y
+		else if (rdm == 3)
 		{
-			for (int k = 0; k < zSimulationSize; k++)
+			if(k > 0 && isFree(i, j, k - 1))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j, k - 1));
+			
+			//+x
+			else if (i < grid.sizeX - 1 && isFree(i + 1, j, k))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i + 1, j, k));
+			//-x
+			else if (i > 0 && isFree(i - 1, j, k))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i - 1, j, k));
+			//+y
+			else if (k < grid.sizeZ - 1 && isFree(i, j, k + 1))
+				swapVoxelPosition(grid, vec3Int(i, j, k), vec3Int(i, j, k + 1));
+		}
+	});
+}
+
+//Performs a single simulation step with the 2x2x2 block rule, alternating the block offset each step; obstacles
+//count as occupied cells that never move
+template <typename Grid, typename Obstacles>
+void updateVoxelMatrixMargolus(Grid& grid, const Obstacles& obstacles)
+{
+	static const MargolusRule rule;
+	static unsigned step = 0;
+
+	rule.apply(grid, step++, obstacles);
+}
+
+//Performs a single simulation step with the intent/resolve rule, which gives the same result for any thread count;
+//obstacles count as taken
+template <typename Grid, typename Obstacles>
+void updateVoxelMatrixIntent(Grid& grid, const Obstacles& obstacles)
+{
+	static IntentResolveRule rule;
+	static unsigned step = 0;
+
+	rule.apply(grid, step++, obstacles, jobSystem());
+}
+
+//Performs a single simulation step with the density rule, in which heavier materials sink through lighter ones and
+//obstacles count as solid
+template <typename Grid, typename Obstacles>
+void updateVoxelMatrixDensity(Grid& grid, const Obstacles& obstacles)
+{
+	static DensityRule rule;
+	static unsigned step = 0;
+
+	rule.apply(grid, step++, obstacles, jobSystem());
+}
+
+//The bitboard layout runs the random rule 64 cells at a time instead of voxel by voxel
+void updateVoxelMatrixRandom(BitboardVoxelGrid& grid)
+{
+	grid.stepRandom();
+}
+
+//The bitboard kernel keeps its own generator, seed it with BitboardVoxelGrid::seed() instead
+void updateVoxelMatrixRandom(BitboardVoxelGrid& grid, std::mt19937&)
+{
+	grid.stepRandom();
+}
+
+//The word-parallel kernel bypasses placeVoxel, so the pyramid is rebuilt after it
+void updateVoxelMatrixRandom(PyramidTrackedGrid<BitboardVoxelGrid>& grid)
+{
+	grid.inner().stepRandom();
+	grid.rebuildPyramid();
+}
+
+//Fills the offset instanced array with the offset for each voxel, all at level 0, and returns how many were written
+template <typename Grid>
+int fillOffsetsArray(const Grid& grid, instanceFrame& instances)
+{
+	instances.offsets.clear();
+	grid.forEachVoxel([&](int i, int j, int k, const voxelPosition& cell)
+	{
+		instances.offsets.push_back(packVoxel(i, j, k, materialInstanceIndex(cell.material)));
+	});
+	int voxelsDrawn = (int)instances.offsets.size();
+
+	std::fill(instances.lodInstanceCount, instances.lodInstanceCount + lodChunkLevel + 1, 0);
+	std::fill(instances.lodFirst, instances.lodFirst + lodChunkLevel + 1, voxelsDrawn);
+	instances.lodFirst[0] = 0;
+	instances.lodInstanceCount[0] = voxelsDrawn;
+	return voxelsDrawn;
+}
+
+//Fills the offset instanced array with the cells picked by selectLodCells, grouped by level into lodFirst/lodInstanceCount.
+//Chunks are selected as jobs into per-worker lists when the layout allows concurrent reads, on this thread otherwise.
+//The lists live in the workers' frame arenas. Level 0 cells carry their material; merged cells are drawn as water.
+template <typename Grid>
+void fillOffsetsArrayLod(const PyramidTrackedGrid<Grid>& grid, const lodView& view, instanceFrame& instances, FrameArenas& arenas)
+{
+	const int levelCount = lodChunkLevel + 1;
+	int workers = jobSystem().workerCount();
+	//lists[worker * levelCount + level], each allocating from its worker's arena
+	arenaVector<packedVoxel>* lists = arenas.current().allocateArray<arenaVector<packedVoxel>>((size_t)workers * levelCount);
+	for (int w = 0; w < workers; w++)
+		for (int level = 0; level < levelCount; level++)
+			new (&lists[w * levelCount + level]) arenaVector<packedVoxel>(ArenaAllocator<packedVoxel>(arenas[w]));
+
+	auto selectChunks = [&](int firstChunk, int lastChunk, int worker)
+	{
+		selectLodCells(grid, grid.pyramid(), view, [&](int level, int x, int y, int z)
+		{
+			unsigned material = level == 0 ? materialInstanceIndex(grid.materialAt(x, y, z)) : 0;
+			lists[worker * levelCount + level].push_back(packVoxel(x, y, z, material));
+		}, firstChunk, lastChunk);
+	};
+	int chunks = lodChunkCount(grid.pyramid(), view);
+	if (concurrentReads<PyramidTrackedGrid<Grid>>::value)
+		jobSystem().parallelFor(0, chunks, selectChunks);
+	else
+		selectChunks(0, chunks, jobSystem().currentWorker());
+
+	size_t total = 0;
+	for (int list = 0; list < workers * levelCount; list++)
+		total += lists[list].size();
+	instances.offsets.resize(total);
+
+	int written = 0;
+	for (int level = 0; level <= lodChunkLevel; level++)
+	{
+		instances.lodFirst[level] = written;
+		for (int w = 0; w < workers; w++)
+		{
+			const arenaVector<packedVoxel>& cells = lists[w * levelCount + level];
+			std::copy(cells.begin(), cells.end(), instances.offsets.begin() + written);
+			written += (int)cells.size();
+		}
+		instances.lodInstanceCount[level] = written - instances.lodFirst[level];
+	}
+}
+
+//Fills the lower half of a grid with a fixed-seed 1 in 4 chance per cell, so every layout starts from the same state
+template <typename Grid>
+int fillBenchmarkGrid(Grid& grid)
+{
+	std::mt19937 gen(1234);
+	int placed = 0;
+
+	for (int i = 0; i < grid.sizeX; i++)
+	{
+		for (int j = 0; j < grid.sizeY / 2; j++)
+		{
+			for (int k = 0; k < grid.sizeZ; k++)
 			{
-				if (voxelMatrix[i][j][k].containsVoxel)
+				if ((gen() & 3) == 0)
 				{
-					//Pick random direction to start sampling +x, -x, +y, -y
-					rdm = randomIntInRange(0, 3);
-
-					//Move down if none beneath and not at floor
-					if (j > 0 && !voxelMatrix[i][j - 1][k].containsVoxel)
-					{
-						swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j - 1, k));
-					}
-					//+x
-					else if (rdm == 0)
-					{
-						if(i < xSimulationSize - 1 && !voxelMatrix[i + 1][j][k].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i + 1, j, k));
-
-						//-x
-						else if(i > 0 && !voxelMatrix[i - 1][j][k].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i - 1, j, k));
-						//+y
-						else if(k < zSimulationSize - 1 && !voxelMatrix[i][j][k + 1].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j, k + 1));
-						//-y
-						else if(k > 0 && !voxelMatrix[i][j][k - 1].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j, k - 1));
-					}
-					//-x
-					else if (rdm == 1)
-					{
-						if(i > 0 && !voxelMatrix[i - 1][j][k].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i - 1, j, k));
-
-						//+y
-						else if (k < zSimulationSize - 1 && !voxelMatrix[i][j][k + 1].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j, k + 1));
-						//-y
-						else if (k > 0 && !voxelMatrix[i][j][k - 1].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j, k - 1));
-						//+x
-						else if (i < xSimulationSize - 1 && !voxelMatrix[i + 1][j][k].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i + 1, j, k));
-					}
-					//+y
-					else if (rdm == 2)
-					{
-						if(k < zSimulationSize - 1 && !voxelMatrix[i][j][k + 1].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j, k + 1));
-
-						//-y
-						else if (k > 0 && !voxelMatrix[i][j][k - 1].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j, k - 1));
-						//+x
-						else if (i < xSimulationSize - 1 && !voxelMatrix[i + 1][j][k].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i + 1, j, k));
-						//-x
-						else if (i > 0 && !voxelMatrix[i - 1][j][k].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i - 1, j, k));
-					}
-					//-y
-					else if (rdm == 3)
-					{
-						if(k > 0 && !voxelMatrix[i][j][k - 1].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j, k - 1));
-						
-						//+x
-						else if (i < xSimulationSize - 1 && !voxelMatrix[i + 1][j][k].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i + 1, j, k));
-						//-x
-						else if (i > 0 && !voxelMatrix[i - 1][j][k].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i - 1, j, k));
-						//+y
-						else if (k < zSimulationSize - 1 && !voxelMatrix[i][j][k + 1].containsVoxel)
-							swapVoxelPosition(vec3Int(i, j, k), vec3Int(i, j, k + 1));
-					}
+					grid.placeVoxel(i, j, k);
+					placed++;
 				}
 			}
 		}
 	}
+	return placed;
 }
 
-//Fills the offset instanced array with the offset for each voxel
-void fillOffsetsArray()
+//Layouts with extra counters print them after their benchmark line
+template <typename Grid>
+void printGridStats(const Grid&) {}
+
+void printGridStats(const PagedVoxelGrid& grid)
 {
-	int voxelsDrawn = 0;
+	const PagedVoxelGrid::PagingStats& stats = grid.stats();
+	std::cout << "\tpage-ins " << stats.pageIns << " (" << stats.prefetchHits << " prefetched of " << stats.prefetchesIssued << " issued), page-outs " << stats.pageOuts
+		<< ", stall " << stats.stallSeconds * 1000.0 << " ms, " << grid.residentChunkCount() << " chunks resident" << std::endl;
+}
 
-	for (int i = 0; i < xSimulationSize; i++)
+//Times updateVoxelMatrixRandom and fillOffsetsArray on one layout, with hardware counters around each if counters is set
+template <typename Grid>
+void benchmarkLayout(const char* name, int size, int steps, PerfCounters* counters)
+{
+	Grid* grid = new Grid(size, size, size);
+	int placed = fillBenchmarkGrid(*grid);
+	counterTotals stepCounts, fillCounts;
+	//Room for every voxel up front, so the fill is timed without the instance array growing
+	instanceFrames[0].offsets.reserve(placed);
+
+	auto start = std::chrono::steady_clock::now();
+	if (counters)
+		counters->start();
+	for (int s = 0; s < steps; s++)
 	{
-		for (int j = 0; j < ySimulationSize; j++)
+		updateVoxelMatrixRandom(*grid);
+	}
+	if (counters)
+		counters->stop(stepCounts);
+	auto mid = std::chrono::steady_clock::now();
+	if (counters)
+		counters->start();
+	fillOffsetsArray(*grid, instanceFrames[0]);
+	if (counters)
+		counters->stop(fillCounts);
+	auto end = std::chrono::steady_clock::now();
+
+	double stepMs = std::chrono::duration<double, std::milli>(mid - start).count() / steps;
+	double fillMs = std::chrono::duration<double, std::milli>(end - mid).count();
+
+	//Mean height and occupied columns summarise the state so layouts with different kernels can be compared
+	double heightSum = 0;
+	long long voxels = 0;
+	std::vector<char> columns((size_t)size * size, 0);
+	grid->forEachVoxel([&](int i, int j, int k, const voxelPosition&)
+	{
+		heightSum += j;
+		voxels++;
+		columns[(size_t)i * size + k] = 1;
+	});
+	long long occupiedColumns = 0;
+	for (char column : columns)
+		occupiedColumns += column;
+
+	std::cout << name << "\t" << size << "^3\t" << placed << " voxels\t" << stepMs << " ms/step\t" << fillMs << " ms/fill\t" << (grid->memoryBytes() >> 20) << " MB\t"
+		<< (voxels ? heightSum / voxels : 0) << "\t" << occupiedColumns << std::endl;
+	if (counters && counters->available())
+	{
+		std::cout << "  step: " << describeCounters(stepCounts, steps) << std::endl;
+		std::cout << "  fill: " << describeCounters(fillCounts, 1) << std::endl;
+	}
+	printGridStats(*grid);
+	delete grid;
+}
+
+//--benchmark-layouts [steps] [size...] [dense|morton|sparse|paged|bitboard] [--perf-counters]
+//Sizes default to 64 128 256; 512 needs roughly 3 GB per dense layout. Naming one layout runs only that layout,
+//which is how to compare cache misses: "perf stat -e cache-misses,L1-dcache-load-misses <exe> --benchmark-layouts 10 256 morton".
+//--perf-counters reads the same counters in process, separately for the step and fill phases (see perfCounters.h).
+void runLayoutBenchmark(int argc, char* argv[])
+{
+	bool stepsGiven = argc > 0 && isdigit((unsigned char)argv[0][0]);
+	int steps = stepsGiven ? std::stoi(argv[0]) : 10;
+	std::vector<int> sizes;
+	std::string only;
+	bool useCounters = false;
+	for (int a = stepsGiven ? 1 : 0; a < argc; a++)
+	{
+		if (strcmp(argv[a], "--perf-counters") == 0)
+			useCounters = true;
+		else if (isdigit((unsigned char)argv[a][0]))
+			sizes.push_back(std::stoi(argv[a]));
+		else
+			only = argv[a];
+	}
+	PerfCounters perfCounters;
+	PerfCounters* counters = useCounters ? &perfCounters : nullptr;
+	if (sizes.empty())
+		sizes = { 64, 128, 256 };
+
+	std::cout << "layout\tsize\tvoxels\tstep time\tinstance fill\tmemory\tmean height\toccupied columns" << std::endl;
+	for (int size : sizes)
+	{
+		if (only.empty() || only == "dense")
+			benchmarkLayout<DenseVoxelGrid>("dense", size, steps, counters);
+		if (only.empty() || only == "morton")
+			benchmarkLayout<MortonVoxelGrid>("morton", size, steps, counters);
+		if (only.empty() || only == "sparse")
+			benchmarkLayout<SparseVoxelMatrix>("sparse", size, steps, counters);
+		if (only.empty() || only == "paged")
+			benchmarkLayout<PagedVoxelGrid>("paged", size, steps, counters);
+		if (only.empty() || only == "bitboard")
+			benchmarkLayout<BitboardVoxelGrid>("bitboard", size, steps, counters);
+	}
+}
+
+//--benchmark-lod [size] [steps] [targetPixels] [--perf-counters]
+//Times the random rule with and without pyramid upkeep, checks the incrementally kept pyramid against a rebuild, then
+//counts the triangles drawn with and without level of detail from the default camera angles at increasing distances.
+//--perf-counters adds hardware counters for both step runs and each selection (see perfCounters.h).
+void runLodBenchmark(int argc, char* argv[])
+{
+	//Positional arguments end at the first flag
+	int positional = 0;
+	while (positional < argc && strncmp(argv[positional], "--", 2) != 0)
+		positional++;
+	int size = positional > 0 ? std::stoi(argv[0]) : 128;
+	int steps = positional > 1 ? std::stoi(argv[1]) : 10;
+	float targetPixels = positional > 2 ? std::stof(argv[2]) : lodTargetPixels;
+	bool useCounters = false;
+	for (int a = positional; a < argc; a++)
+		useCounters = useCounters || strcmp(argv[a], "--perf-counters") == 0;
+	PerfCounters counters;
+	useCounters = useCounters && counters.available();
+	counterTotals stepCounts[2], selectCounts;
+
+	DenseVoxelGrid plain(size, size, size);
+	PyramidTrackedGrid<DenseVoxelGrid> tracked(size, size, size);
+	long long voxels = fillBenchmarkGrid(plain);
+	fillBenchmarkGrid(tracked);
+
+	double stepMs[2];
+	for (int run = 0; run < 2; run++)
+	{
+		randomGenerator().seed(1);
+		auto start = std::chrono::steady_clock::now();
+		if (useCounters)
+			counters.start();
+		for (int s = 0; s < steps; s++)
 		{
-			for (int k = 0; k < zSimulationSize; k++)
+			if (run == 0)
+				updateVoxelMatrixRandom(plain);
+			else
+				updateVoxelMatrixRandom(tracked);
+		}
+		if (useCounters)
+			counters.stop(stepCounts[run]);
+		stepMs[run] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / steps;
+	}
+
+	OccupancyPyramid rebuilt(size, size, size);
+	auto rebuildStart = std::chrono::steady_clock::now();
+	rebuilt.rebuild(tracked);
+	double rebuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - rebuildStart).count();
+
+	std::cout << size << "^3, " << voxels << " voxels: " << stepMs[0] << " ms/step plain, " << stepMs[1] << " ms/step with pyramid upkeep, "
+		<< rebuildMs << " ms full rebuild, " << (tracked.pyramid().memoryBytes() >> 10) << " KB, "
+		<< (rebuilt == tracked.pyramid() ? "consistent" : "MISMATCH") << " after " << steps << " steps" << std::endl;
+	if (useCounters)
+	{
+		std::cout << "  plain step: " << describeCounters(stepCounts[0], steps) << std::endl;
+		std::cout << "  step with pyramid upkeep: " << describeCounters(stepCounts[1], steps) << std::endl;
+	}
+
+	glm::vec3 center = glm::vec3(size * voxelSpacing / 2.0f);
+	std::cout << "distance	full triangles	lod triangles	fraction	select time	cells per level" << std::endl;
+	for (float distance : { 100.0f, 250.0f, 500.0f, 1000.0f, 1500.0f })
+	{
+		lodView view;
+		view.cameraPosition = center + distance * glm::vec3(sin(camRotHorizontal) * sin(camRotVertical), cos(camRotVertical), cos(camRotHorizontal) * sin(camRotVertical));
+		view.voxelSpacing = voxelSpacing;
+		view.pixelsPerUnit = 600.0f / (2.0f * tan(glm::radians(45.0f) / 2.0f));
+		view.targetPixels = targetPixels;
+		view.chunkLevel = lodChunkLevel;
+
+		long long perLevel[lodChunkLevel + 1] = {};
+		auto start = std::chrono::steady_clock::now();
+		if (useCounters)
+			counters.start();
+		selectLodCells(tracked, tracked.pyramid(), view, [&](int level, int, int, int) { perLevel[level]++; });
+		if (useCounters)
+			counters.stop(selectCounts);
+		double selectMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		long long cells = 0;
+		for (long long count : perLevel)
+			cells += count;
+		std::cout << distance << "	" << voxels * 12 << "	" << cells * 12 << "	" << (double)cells / voxels << "	" << selectMs << " ms	";
+		for (int level = 0; level <= lodChunkLevel; level++)
+			std::cout << perLevel[level] << (level < lodChunkLevel ? "/" : "\n");
+	}
+	if (useCounters)
+		std::cout << "  selection, per distance: " << describeCounters(selectCounts, 5) << std::endl;
+}
+
+//--raytrace [frames] [size] [width] [height] [threads] [ppm|png|none]
+//Steps the random rule and renders each frame on the CPU from the interactive camera, writing frame_0000.ppm onwards
+void runRaytraceMode(int argc, char* argv[])
+{
+	int frames = argc > 0 ? std::stoi(argv[0]) : 10;
+	int size = argc > 1 ? std::stoi(argv[1]) : 128;
+	int width = argc > 2 ? std::stoi(argv[2]) : 1280;
+	int height = argc > 3 ? std::stoi(argv[3]) : 720;
+	int threads = argc > 4 ? std::stoi(argv[4]) : (int)std::max(1u, std::thread::hardware_concurrency());
+	std::string format = argc > 5 ? argv[5] : "ppm";
+
+	SimulationGrid grid(size, size, size);
+	long long voxels = fillBenchmarkGrid(grid);
+	CpuRayTracer tracer(size, size, size, voxelSpacing);
+	std::vector<uint8_t> image;
+
+	//Same orbit as the window, moved back so the larger grid fills the view the same way
+	glm::vec3 center = glm::vec3(size * voxelSpacing / 2.0f);
+	float distance = camDistance * size / xSimulationSize;
+	glm::vec3 eye = center + distance * glm::vec3(sin(camRotHorizontal) * sin(camRotVertical), cos(camRotVertical), cos(camRotHorizontal) * sin(camRotVertical));
+
+	JobSystem jobs(threads);
+	std::cout << size << "^3, " << voxels << " voxels, " << width << "x" << height << ", " << threads << " threads" << std::endl;
+	double stepMs = 0, renderMs = 0, writeMs = 0;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		updateVoxelMatrixRandom(grid);
+		auto stepped = std::chrono::steady_clock::now();
+		tracer.upload(grid);
+		tracer.render(eye, center, 45.0f, width, height, jobs, image);
+		auto rendered = std::chrono::steady_clock::now();
+
+		char path[64];
+		if (format == "png")
+		{
+			snprintf(path, sizeof(path), "frame_%04d.png", frame);
+			writePNG(path, width, height, image.data());
+		}
+		else if (format == "ppm")
+		{
+			snprintf(path, sizeof(path), "frame_%04d.ppm", frame);
+			writePPM(path, width, height, image.data());
+		}
+		auto written = std::chrono::steady_clock::now();
+
+		stepMs += std::chrono::duration<double, std::milli>(stepped - start).count();
+		renderMs += std::chrono::duration<double, std::milli>(rendered - stepped).count();
+		writeMs += std::chrono::duration<double, std::milli>(written - rendered).count();
+	}
+	std::cout << stepMs / frames << " ms/step, " << renderMs / frames << " ms/render (" << 1000.0 * frames / renderMs << " fps), "
+		<< writeMs / frames << " ms/write" << std::endl;
+	printJobStats(jobs);
+}
+
+//--benchmark-surface [size] [steps] [threads]
+//Times a full surface extraction, then the incremental remesh after each step of the random rule, and compares the
+//triangle count with drawing one cube per voxel
+void runSurfaceBenchmark(int argc, char* argv[])
+{
+	int size = argc > 0 ? std::stoi(argv[0]) : 128;
+	int steps = argc > 1 ? std::stoi(argv[1]) : 10;
+	int threads = argc > 2 ? std::stoi(argv[2]) : (int)std::max(1u, std::thread::hardware_concurrency());
+
+	SimulationGrid grid(size, size, size);
+	long long voxels = fillBenchmarkGrid(grid);
+	JobSystem jobs(threads);
+	FrameArena arena;
+	SurfaceMesher mesher(size, size, size, voxelSpacing, jobs);
+	mesher.update(grid, arena);
+	std::cout << size << "^3, " << voxels << " voxels, " << threads << " threads: full mesh " << mesher.lastUpdateMilliseconds << " ms, "
+		<< mesher.triangleCount() << " triangles (" << voxels * 12 << " as cubes), " << mesher.vertices().size() << " vertices" << std::endl;
+
+	double meshMs = 0;
+	long long remeshed = 0;
+	for (int s = 0; s < steps; s++)
+	{
+		updateVoxelMatrixRandom(grid);
+		arena.reset();
+		mesher.update(grid, arena);
+		meshMs += mesher.lastUpdateMilliseconds;
+		remeshed += mesher.lastRemeshedChunks;
+	}
+	//Only remeshing changed chunks must give the same mesh as meshing everything
+	SurfaceMesher rebuilt(size, size, size, voxelSpacing, jobs);
+	arena.reset();
+	rebuilt.update(grid, arena);
+	bool consistent = rebuilt.indices() == mesher.indices() && rebuilt.vertices().size() == mesher.vertices().size() &&
+		std::equal(rebuilt.vertices().begin(), rebuilt.vertices().end(), mesher.vertices().begin(),
+			[](const surfaceVertex& a, const surfaceVertex& b) { return a.position == b.position && a.normal == b.normal; });
+	//Watertight means every triangle edge a -> b has a matching b -> a in a neighbouring triangle
+	std::vector<uint64_t> edges, reversed;
+	const std::vector<uint32_t>& indices = mesher.indices();
+	for (size_t t = 0; t < indices.size(); t += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			uint64_t a = indices[t + e], b = indices[t + (e + 1) % 3];
+			edges.push_back(a << 32 | b);
+			reversed.push_back(b << 32 | a);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	std::sort(reversed.begin(), reversed.end());
+	std::vector<uint64_t> open;
+	std::set_symmetric_difference(edges.begin(), edges.end(), reversed.begin(), reversed.end(), std::back_inserter(open));
+	std::cout << "after each step: " << meshMs / steps << " ms, " << (double)remeshed / steps << "/" << mesher.totalChunks() << " chunks remeshed, "
+		<< mesher.triangleCount() << " triangles, " << (consistent ? "consistent" : "MISMATCH") << " with a full remesh, "
+		<< open.size() / 2 << " open edges" << std::endl;
+	printJobStats(jobs);
+}
+
+//--check-intent [steps] [threads] [size]
+//Runs the intent/resolve rule from the same fill on one thread and on several, and checks the final states match
+void runIntentCheck(int argc, char* argv[])
+{
+	int steps = argc > 0 ? std::stoi(argv[0]) : 50;
+	int threads = argc > 1 ? std::stoi(argv[1]) : (int)std::max(1u, std::thread::hardware_concurrency());
+	int size = argc > 2 ? std::stoi(argv[2]) : 64;
+
+	std::vector<uint8_t> results[2];
+	int threadCounts[2] = { 1, threads };
+	for (int run = 0; run < 2; run++)
+	{
+		DenseVoxelGrid grid(size, size, size);
+		fillBenchmarkGrid(grid);
+		IntentResolveRule rule;
+		JobSystem jobs(threadCounts[run]);
+
+		auto start = std::chrono::steady_clock::now();
+		long long moved = 0;
+		for (int s = 0; s < steps; s++)
+			moved += rule.apply(grid, s, noObstacles(), jobs);
+		double stepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / steps;
+
+		results[run] = rule.occupancy();
+		std::cout << threadCounts[run] << " thread(s)\t" << stepMs << " ms/step\t" << moved << " moves" << std::endl;
+		printJobStats(jobs);
+	}
+	std::cout << (results[0] == results[1] ? "identical" : "MISMATCH") << " after " << steps << " steps" << std::endl;
+}
+
+//Runs the density rule on one layout from a fill that has the materials upside down: oil at the bottom, water in the
+//middle and sand on top, a random half of each band's cells filled from a fixed seed. Returns the material of every
+//cell afterwards in x, y, z order, and the count of each material before and after.
+template <typename Grid>
+std::vector<uint8_t> runDensityLayout(const char* name, int size, int steps, JobSystem& jobs, long long* before, long long* after)
+{
+	Grid* grid = new Grid(size, size, size);
+	std::mt19937 gen(7);
+	std::fill(before, before + MATERIAL_COUNT, 0);
+	std::fill(after, after + MATERIAL_COUNT, 0);
+	for (int i = 0; i < size; i++)
+	{
+		for (int j = 0; j < size; j++)
+		{
+			for (int k = 0; k < size; k++)
 			{
-				if (voxelMatrix[i][j][k].containsVoxel)
-				{
-					offsetArray[3 * voxelsDrawn] = i * voxelSpacing;
-					offsetArray[3 * voxelsDrawn + 1] = j * voxelSpacing;
-					offsetArray[3 * voxelsDrawn + 2] = k * voxelSpacing;
-					voxelsDrawn++;
-				}
+				uint8_t material = j < size / 3 ? MATERIAL_OIL : (j < 2 * size / 3 ? MATERIAL_WATER : MATERIAL_SAND);
+				if (gen() & 1)
+					continue;
+				grid->placeVoxel(i, j, k, glm::vec3(0.0f), material);
+				before[material]++;
 			}
 		}
 	}
+
+	DensityRule rule;
+	auto start = std::chrono::steady_clock::now();
+	for (int s = 0; s < steps; s++)
+		rule.apply(*grid, s, noObstacles(), jobs);
+	double stepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / steps;
+
+	std::vector<uint8_t> materials((size_t)size * size * size, MATERIAL_EMPTY);
+	double heights[MATERIAL_COUNT] = {};
+	grid->forEachVoxel([&](int i, int j, int k, const voxelPosition&)
+	{
+		uint8_t material = grid->materialAt(i, j, k);
+		materials[((size_t)i * size + j) * size + k] = material;
+		after[material]++;
+		heights[material] += j;
+	});
+	delete grid;
+
+	std::cout << name << "	" << stepMs << " ms/step	mean height";
+	for (int material = MATERIAL_WATER; material < MATERIAL_SOLID; material++)
+		std::cout << " " << materialName(material) << " " << (after[material] > 0 ? heights[material] / after[material] : 0);
+	std::cout << std::endl;
+	return materials;
+}
+
+//--check-density [steps] [size] [threads]
+//Runs the density rule on the dense, sparse and Morton layouts from the same fill, and checks every layout keeps the
+//count of each material and ends in the same state
+void runDensityCheck(int argc, char* argv[])
+{
+	int steps = argc > 0 ? std::stoi(argv[0]) : 600;
+	int size = argc > 1 ? std::stoi(argv[1]) : 30;
+	int threads = argc > 2 ? std::stoi(argv[2]) : (int)std::max(1u, std::thread::hardware_concurrency());
+	JobSystem jobs(threads);
+
+	long long before[3][MATERIAL_COUNT], after[3][MATERIAL_COUNT];
+	std::vector<uint8_t> results[3];
+	results[0] = runDensityLayout<DenseVoxelGrid>("dense", size, steps, jobs, before[0], after[0]);
+	results[1] = runDensityLayout<SparseVoxelMatrix>("sparse", size, steps, jobs, before[1], after[1]);
+	results[2] = runDensityLayout<MortonVoxelGrid>("morton", size, steps, jobs, before[2], after[2]);
+
+	bool conserved = true;
+	for (int layout = 0; layout < 3; layout++)
+		for (int material = MATERIAL_WATER; material < MATERIAL_COUNT; material++)
+			conserved = conserved && before[layout][material] == after[layout][material];
+	std::cout << "water " << after[0][MATERIAL_WATER] << ", sand " << after[0][MATERIAL_SAND] << ", oil " << after[0][MATERIAL_OIL] << " voxels "
+		<< (conserved ? "conserved" : "MISMATCH") << "; layouts " << (results[0] == results[1] && results[0] == results[2] ? "identical" : "MISMATCH")
+		<< " after " << steps << " steps" << std::endl;
+}
+
+//--check-distance-field [obstacle file] [threads]
+//Builds the obstacle distance field for the interactive grid (obstacles.txt by default), compares every cell with a
+//brute-force distance to the nearest cell across the surface, and checks the largest error fits the collision slack
+void runDistanceFieldCheck(int argc, char* argv[])
+{
+	std::string path = argc > 0 ? argv[0] : "obstacles.txt";
+	int threads = argc > 1 ? std::stoi(argv[1]) : (int)std::max(1u, std::thread::hardware_concurrency());
+
+	ObstacleField field(xSimulationSize, ySimulationSize, zSimulationSize);
+	if (!field.load(path))
+		return;
+	JobSystem jobs(threads);
+	field.buildDistanceField(jobs);
+	ObstacleField::fieldCheck check = field.checkAgainstBruteForce(jobs);
+
+	std::cout << field.solidCellCount() << " solid cells, field built in " << field.buildMilliseconds << " ms (" << field.sweepCount << " sweeps)" << std::endl;
+	//ObstacleField::moveClear and cubeClear allow one cell of slack, of which obstacle corners take sqrt(3)/2 - 1/2 and the
+	//rest covers error in the field
+	float tolerance = 1.0f - (std::sqrt(3.0f) / 2.0f - 0.5f);
+	std::cout << check.cells << " cells, " << (check.cells > 0 ? 100.0 * check.exact / check.cells : 0) << "% exact, largest error "
+		<< check.largestError << " cells: " << (check.largestError <= tolerance ? "within" : "MISMATCH, outside") << " the "
+		<< tolerance << " cells collision tests allow" << std::endl;
+}
+
+//Places voxels in random free cells of the lower half of a grid, each moving at speed cells per step in a random
+//direction, from a fixed seed so every layout starts from the same state
+template <typename Grid>
+int fillSweptBenchmarkGrid(Grid& grid, int voxels, float speed)
+{
+	std::mt19937 gen(1234);
+	std::uniform_int_distribution<int> pickX(0, grid.sizeX - 1), pickY(0, grid.sizeY / 2 - 1), pickZ(0, grid.sizeZ - 1);
+	std::normal_distribution<float> direction(0.0f, 1.0f);
+	int placed = 0;
+	for (int attempt = 0; attempt < 4 * voxels && placed < voxels; attempt++)
+	{
+		int x = pickX(gen), y = pickY(gen), z = pickZ(gen);
+		glm::vec3 velocity(direction(gen), direction(gen), direction(gen));
+		if (grid.containsVoxel(x, y, z) || glm::length(velocity) < 1e-3f)
+			continue;
+		grid.placeVoxel(x, y, z, glm::normalize(velocity) * speed);
+		placed++;
+	}
+	return placed;
+}
+
+//Times the swept velocity rule on one layout and checks no voxel was lost or left the grid
+template <typename Grid>
+void benchmarkSwept(const char* name, int size, int voxels, float speed, int steps)
+{
+	Grid* grid = new Grid(size, size, size);
+	int placed = fillSweptBenchmarkGrid(*grid, voxels, speed);
+	sweptMoveScratch scratch;
+	sweptMoveStats stats;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int s = 0; s < steps; s++)
+		updateVoxelMatrixVelocity(*grid, noObstacles(), scratch, &stats);
+	double stepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / steps;
+
+	long long remaining = 0;
+	grid->forEachVoxel([&](int, int, int, const voxelPosition&) { remaining++; });
+	double perVoxel = stats.voxels > 0 ? 100.0 / stats.voxels : 0;
+	std::cout << name << "\t" << placed << " voxels\t" << stepMs << " ms/step\t" << stats.withinCell * perVoxel << "% in cell\t"
+		<< stats.walked * perVoxel << "% walked (" << (stats.walked > 0 ? (double)stats.cellsVisited / stats.walked : 0) << " cells, "
+		<< (stats.walked > 0 ? (double)stats.blocksSkipped / stats.walked : 0) << " cubes skipped each)\t" << stats.blocked * perVoxel << "% blocked" << std::endl;
+	if (remaining != placed)
+		std::cout << "ERROR::SWEPT::VOXELS_LOST: " << placed << " placed, " << remaining << " left" << std::endl;
+	delete grid;
+}
+
+//--benchmark-swept [size] [voxels] [speed] [steps]
+//Launches voxels at speed cells per step in random directions (default 24, about half the grid per step) and times the
+//velocity rule on a dense grid, where walks visit every cell, and on grids with an occupancy pyramid, where walks jump
+//empty cubes of cells.
+void runSweptBenchmark(int argc, char* argv[])
+{
+	int size = argc > 0 ? std::stoi(argv[0]) : 64;
+	int voxels = argc > 1 ? std::stoi(argv[1]) : 5000;
+	float speed = argc > 2 ? std::stof(argv[2]) : 24.0f;
+	int steps = argc > 3 ? std::stoi(argv[3]) : 50;
+
+	std::cout << size << "^3, " << speed << " cells/step, " << steps << " steps" << std::endl;
+	benchmarkSwept<DenseVoxelGrid>("dense", size, voxels, speed, steps);
+	benchmarkSwept<PyramidTrackedGrid<DenseVoxelGrid>>("dense+pyramid", size, voxels, speed, steps);
+	benchmarkSwept<PyramidTrackedGrid<SparseVoxelMatrix>>("sparse+pyramid", size, voxels, speed, steps);
+}
+
+#if defined(__linux__)
+
+//One rank of a decomposed run: fills its slab, then steps with halo exchange and migration through the shared exchange
+void runSlabRank(SlabExchange& exchange, int rank, int ranks, int steps, int slabWidth, int size)
+{
+	randomGenerator().seed(1000 + rank);
+	SlabGrid slab(slabWidth, size, size);
+	std::mt19937 gen(rank);
+	for (int i = 1; i <= slabWidth; i++)
+		for (int j = 0; j < size / 2; j++)
+			for (int k = 0; k < size; k++)
+				if ((gen() & 3) == 0)
+					slab.placeVoxel(i, j, k);
+
+	SlabExchange::rankSlot& slot = exchange.slot(rank);
+	slot.displaced = 0;
+	exchange.barrier();
+
+	auto start = std::chrono::steady_clock::now();
+	for (int s = 0; s < steps; s++)
+	{
+		//Halo exchange
+		slab.storeBoundary(0, exchange.haloPlane(rank, 0));
+		slab.storeBoundary(1, exchange.haloPlane(rank, 1));
+		exchange.barrier();
+		slab.loadGhost(0, rank > 0 ? exchange.haloPlane(rank - 1, 1) : nullptr);
+		slab.loadGhost(1, rank < ranks - 1 ? exchange.haloPlane(rank + 1, 0) : nullptr);
+
+		slab.beginStep(s);
+		updateVoxelMatrixRandom(slab);
+
+		//Migration
+		for (int side = 0; side < 2; side++)
+		{
+			slot.migrantCount[side] = (int)slab.outgoing[side].size();
+			if (!slab.outgoing[side].empty())
+				memcpy(exchange.migrants(rank, side), slab.outgoing[side].data(), slab.outgoing[side].size() * sizeof(migrantVoxel));
+			slab.outgoing[side].clear();
+		}
+		exchange.barrier();
+		if (rank > 0)
+			slot.displaced += slab.acceptMigrants(0, exchange.migrants(rank - 1, 1), exchange.slot(rank - 1).migrantCount[1]);
+		if (rank < ranks - 1)
+			slot.displaced += slab.acceptMigrants(1, exchange.migrants(rank + 1, 0), exchange.slot(rank + 1).migrantCount[0]);
+		exchange.barrier();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	slot.stepSeconds = std::chrono::duration<double>(end - start).count() / steps;
+	slot.voxelCount = slab.voxelCount();
+}
+
+//Counts the voxels every rank would start with, without forking
+long long expectedDecomposedVoxels(int ranks, int slabWidth, int size)
+{
+	long long total = 0;
+	for (int rank = 0; rank < ranks; rank++)
+	{
+		std::mt19937 gen(rank);
+		for (long long n = 0; n < (long long)slabWidth * (size / 2) * size; n++)
+			if ((gen() & 3) == 0)
+				total++;
+	}
+	return total;
+}
+
+//Forks one process per rank and returns the slowest rank's seconds per step, or a negative value on failure
+double runDecomposed(int ranks, int steps, int slabWidth, int size, long long& finalVoxels, long long& displaced)
+{
+	SlabExchange exchange(ranks, size, size);
+	if (!exchange.valid())
+		return -1;
+
+	std::vector<pid_t> children;
+	for (int rank = 0; rank < ranks; rank++)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			runSlabRank(exchange, rank, ranks, steps, slabWidth, size);
+			_exit(0);
+		}
+		//The ranks already started would wait at the first barrier for this one forever
+		if (pid < 0)
+		{
+			std::cout << "ERROR::DECOMPOSED::FORK_FAILED: rank " << rank << ": " << strerror(errno) << std::endl;
+			for (pid_t child : children)
+				kill(child, SIGKILL);
+			for (pid_t child : children)
+				waitpid(child, nullptr, 0);
+			exchange.abandonBarrier();
+			return -1;
+		}
+		children.push_back(pid);
+	}
+	for (pid_t pid : children)
+		waitpid(pid, nullptr, 0);
+
+	double slowest = 0;
+	finalVoxels = 0;
+	displaced = 0;
+	for (int rank = 0; rank < ranks; rank++)
+	{
+		slowest = std::max(slowest, exchange.slot(rank).stepSeconds);
+		finalVoxels += exchange.slot(rank).voxelCount;
+		displaced += exchange.slot(rank).displaced;
+	}
+	return slowest;
+}
+
+//--decomposed <ranks> [steps] [slab width] [size]  runs one decomposed simulation and validates the global voxel count
+//--weak-scaling <max ranks> [steps] [slab width] [size]  repeats it for 1, 2, 4... ranks with a fixed slab per rank
+void runDecomposedMode(int argc, char* argv[], bool weakScaling)
+{
+	int maxRanks = argc > 0 ? std::stoi(argv[0]) : 4;
+	int steps = argc > 1 ? std::stoi(argv[1]) : 20;
+	int slabWidth = argc > 2 ? std::stoi(argv[2]) : 64;
+	int size = argc > 3 ? std::stoi(argv[3]) : 64;
+
+	std::vector<int> rankCounts;
+	if (weakScaling)
+		for (int ranks = 1; ranks <= maxRanks; ranks *= 2)
+			rankCounts.push_back(ranks);
+	else
+		rankCounts.push_back(maxRanks);
+
+	std::cout << "ranks\tdomain\tms/step\tefficiency\tvoxels\tdisplaced migrants" << std::endl;
+	double baseline = 0;
+	for (int ranks : rankCounts)
+	{
+		long long finalVoxels, displaced;
+		double seconds = runDecomposed(ranks, steps, slabWidth, size, finalVoxels, displaced);
+		if (seconds < 0)
+			return;
+		if (baseline == 0)
+			baseline = seconds;
+
+		long long expected = expectedDecomposedVoxels(ranks, slabWidth, size);
+		std::cout << ranks << "\t" << ranks * slabWidth << "x" << size << "x" << size << "\t" << seconds * 1000.0 << "\t" << baseline / seconds
+			<< "\t" << finalVoxels << (finalVoxels == expected ? " (conserved)" : " (MISMATCH, expected " + std::to_string(expected) + ")") << "\t" << displaced << std::endl;
+	}
+}
+
+#else
+
+void runDecomposedMode(int argc, char* argv[], bool weakScaling)
+{
+	std::cout << "Decomposed runs need fork() and process-shared barriers; only Linux is supported" << std::endl;
+}
+
+#endif
+
+//Grids with their own generator take the member's seed, so every layout's members are reproducible
+template <typename Grid>
+void seedGridRandom(Grid&, unsigned) {}
+
+void seedGridRandom(BitboardVoxelGrid& grid, unsigned seed)
+{
+	grid.seed(seed);
+}
+
+const float ensembleMinFill = 0.1f;
+const float ensembleMaxFill = 0.5f;
+
+//Steps every member of an ensemble on the shared job system, writes a line per member to out and returns the wall
+//clock seconds. placed and voxels are the totals over all members before and after.
+template <typename Grid>
+double runEnsemble(int count, int steps, int size, unsigned firstSeed, std::ostream& out, long long& placed, long long& voxels)
+{
+	SimulationEnsemble<Grid> ensemble(count, size, firstSeed, ensembleMinFill, ensembleMaxFill);
+	for (int m = 0; m < count; m++)
+		seedGridRandom(*ensemble[m].grid, ensemble[m].seed);
+
+	double seconds = ensemble.run(jobSystem(), steps, [](Grid& grid, std::mt19937& random) { updateVoxelMatrixRandom(grid, random); });
+
+	placed = 0;
+	voxels = 0;
+	out << "member\tseed\tfill\tvoxels\tmean height\theight spread\ttop\toccupied columns\tms/step" << std::endl;
+	for (int m = 0; m < count; m++)
+	{
+		const typename SimulationEnsemble<Grid>::member& entry = ensemble[m];
+		const ensembleMemberStats& stats = entry.stats;
+		out << m << "\t" << entry.seed << "\t" << entry.fill << "\t" << stats.voxels << "\t" << stats.meanHeight << "\t" << stats.heightSpread
+			<< "\t" << stats.topHeight << "\t" << stats.occupiedColumns << "\t" << stats.stepMilliseconds << std::endl;
+		placed += entry.placed;
+		voxels += stats.voxels;
+	}
+	return seconds;
+}
+
+#if defined(__linux__)
+
+//The same members as runEnsemble, each in its own forked process with at most concurrent processes alive, the way a
+//script launching one simulation per member would run them. Returns the wall clock seconds. Fork skips exec, loading
+//and startup, so separate launches cost at least this much. Must run before jobSystem() has started its threads.
+//Returns a negative value if a member couldn't be forked.
+template <typename Grid>
+double runEnsembleProcesses(int count, int steps, int size, unsigned firstSeed, int concurrent)
+{
+	auto start = std::chrono::steady_clock::now();
+	int running = 0;
+	for (int m = 0; m < count; m++)
+	{
+		if (running == concurrent && wait(nullptr) > 0)
+			running--;
+
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			float fill = SimulationEnsemble<Grid>::memberFill(m, count, ensembleMinFill, ensembleMaxFill);
+			SimulationEnsemble<Grid> single(1, size, firstSeed + m, fill, fill);
+			seedGridRandom(*single[0].grid, single[0].seed);
+			for (int s = 0; s < steps; s++)
+				updateVoxelMatrixRandom(*single[0].grid, single[0].random);
+			SimulationEnsemble<Grid>::summarize(*single[0].grid);
+			_exit(0);
+		}
+		//Timing fewer members than the ensemble steps would overstate the processes' throughput
+		if (pid < 0)
+		{
+			std::cout << "ERROR::ENSEMBLE::FORK_FAILED: member " << m << ": " << strerror(errno) << std::endl;
+			while (running > 0 && wait(nullptr) > 0)
+				running--;
+			return -1;
+		}
+		running++;
+	}
+	while (running > 0 && wait(nullptr) > 0)
+		running--;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif
+
+//--ensemble [members] [steps] [size] [dense|morton|sparse|bitboard] [--processes] [--out file]
+//Steps many small independent simulations together on the job system, see simulationEnsemble.h. Members get seeds
+//1, 2, 3... and fill fractions spread from 0.1 to 0.5, and the per-member statistics go to stdout or the --out file.
+//--processes first runs the same members as one forked process each (Linux only) to compare throughput.
+void runEnsembleMode(int argc, char* argv[])
+{
+	int numbers[3] = { 64, 200, 48 };
+	int numberCount = 0;
+	std::string layout = "bitboard";
+	std::string outPath;
+	bool compareProcesses = false;
+	for (int a = 0; a < argc; a++)
+	{
+		if (strcmp(argv[a], "--processes") == 0)
+			compareProcesses = true;
+		else if (strcmp(argv[a], "--out") == 0 && a + 1 < argc)
+			outPath = argv[++a];
+		else if (isdigit((unsigned char)argv[a][0]) && numberCount < 3)
+			numbers[numberCount++] = std::stoi(argv[a]);
+		else
+			layout = argv[a];
+	}
+	int count = std::max(1, numbers[0]);
+	int steps = std::max(1, numbers[1]);
+	int size = std::max(2, numbers[2]);
+	const unsigned firstSeed = 1;
+
+	if (layout != "dense" && layout != "morton" && layout != "sparse" && layout != "bitboard")
+	{
+		std::cout << "ERROR::ENSEMBLE::UNKNOWN_LAYOUT " << layout << std::endl;
+		return;
+	}
+
+	std::ofstream outFile;
+	if (!outPath.empty())
+	{
+		outFile.open(outPath);
+		if (!outFile)
+		{
+			std::cout << "ERROR::ENSEMBLE::CANNOT_WRITE " << outPath << std::endl;
+			return;
+		}
+	}
+	std::ostream& out = outPath.empty() ? std::cout : outFile;
+
+	int workers = (int)std::max(1u, std::thread::hardware_concurrency());
+	double processSeconds = 0;
+	if (compareProcesses)
+	{
+#if defined(__linux__)
+		if (layout == "dense")
+			processSeconds = runEnsembleProcesses<DenseVoxelGrid>(count, steps, size, firstSeed, workers);
+		else if (layout == "morton")
+			processSeconds = runEnsembleProcesses<MortonVoxelGrid>(count, steps, size, firstSeed, workers);
+		else if (layout == "sparse")
+			processSeconds = runEnsembleProcesses<SparseVoxelMatrix>(count, steps, size, firstSeed, workers);
+		else
+			processSeconds = runEnsembleProcesses<BitboardVoxelGrid>(count, steps, size, firstSeed, workers);
+#else
+		std::cout << "Process comparison needs fork(); only Linux is supported" << std::endl;
+#endif
+	}
+
+	long long placed = 0, voxels = 0;
+	double seconds;
+	if (layout == "dense")
+		seconds = runEnsemble<DenseVoxelGrid>(count, steps, size, firstSeed, out, placed, voxels);
+	else if (layout == "morton")
+		seconds = runEnsemble<MortonVoxelGrid>(count, steps, size, firstSeed, out, placed, voxels);
+	else if (layout == "sparse")
+		seconds = runEnsemble<SparseVoxelMatrix>(count, steps, size, firstSeed, out, placed, voxels);
+	else
+		seconds = runEnsemble<BitboardVoxelGrid>(count, steps, size, firstSeed, out, placed, voxels);
+
+	double memberSteps = (double)count * steps;
+	std::cout << count << " " << layout << " members of " << size << "^3, " << steps << " steps on " << jobSystem().workerCount() << " worker(s): "
+		<< seconds << " s, " << memberSteps / seconds << " member-steps/s, " << voxels << " voxels "
+		<< (voxels == placed ? "(conserved)" : "(MISMATCH, placed " + std::to_string(placed) + ")") << std::endl;
+	if (processSeconds > 0)
+	{
+		std::cout << "one process per member, " << workers << " at a time: " << processSeconds << " s, " << memberSteps / processSeconds
+			<< " member-steps/s, ensemble is " << processSeconds / seconds << "x faster" << std::endl;
+	}
+	printJobStats(jobSystem());
 }
 
 void mouseScrollCallback(GLFWwindow* window, double xOffset, double yOffset)
@@ -543,6 +2080,33 @@ void processInput(GLFWwindow* window)
 		oPressed = true;
 	}
 	else oPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS)
+	{
+		mPressed = true;
+	}
+	else mPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
+	{
+		iPressed = true;
+	}
+	else iPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
+	{
+		lPressed = true;
+	}
+	else lPressed = false;
+}
+
+//True if flag appears anywhere on the command line
+bool hasFlag(int argc, char* argv[], const char* flag)
+{
+	for (int i = 1; i < argc; i++)
+		if (strcmp(argv[i], flag) == 0)
+			return true;
+	return false;
 }
 
 //A callback for whenever the window is resized
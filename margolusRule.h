@@ -0,0 +1,227 @@
+#ifndef MARGOLUS_RULE_H
+#define MARGOLUS_RULE_H
+
+#include "voxelGrid.h"
+#include <cstdint>
+#include <iostream>
+
+//Block cellular automaton alternative to updateVoxelMatrixRandom. The grid is tiled with 2x2x2 blocks whose origin
+//alternates between (0,0,0) and (1,1,1) on even and odd steps. Each block is updated on its own from its 8-bit
+//occupancy through a precomputed transition table, so no voxel can move twice in a step and the result does not
+//depend on the order blocks are visited in.
+//
+//Cell b of a block is at (b & 1, (b >> 1) & 1, (b >> 2) & 1) relative to the block origin, so cells 2, 3, 6 and 7 are
+//the top layer. The canonical rule lets top voxels fall, then lets voxels that could not fall slide diagonally down, then
+//sideways within their layer, preferring +x over +z. Each block is mirrored or transposed in x/z by one of 8
+//symmetries picked from a hash of its position and the step, which removes the +x/+z preference on average.
+//Blocks that cross the domain edge are skipped on that step. Obstacle cells enter the block state as occupied cells
+//that must stay put, and a block whose transition would move one is left as it is for that step.
+
+class MargolusRule
+{
+public:
+	//next[symmetry][state] is the state after the update; destination[symmetry][state][b] is where the voxel in cell b goes
+	uint8_t next[8][256];
+	uint8_t destination[8][256][8];
+
+	MargolusRule()
+	{
+		uint8_t canonicalNext[256];
+		uint8_t canonicalDestination[256][8];
+		for (int state = 0; state < 256; state++)
+			buildCanonical(state, canonicalNext[state], canonicalDestination[state]);
+
+		for (int symmetry = 0; symmetry < 8; symmetry++)
+		{
+			for (int state = 0; state < 256; state++)
+			{
+				//Transform into the canonical frame, look up, transform back
+				int canonicalState = permuteState(state, symmetry);
+				next[symmetry][state] = (uint8_t)inversePermuteState(canonicalNext[canonicalState], symmetry);
+				for (int b = 0; b < 8; b++)
+					destination[symmetry][state][b] = (uint8_t)inverseCell(canonicalDestination[canonicalState][transformCell(b, symmetry)], symmetry);
+
+				if (popCount(next[symmetry][state]) != popCount(state))
+					std::cout << "ERROR::MARGOLUS::TABLE_NOT_CONSERVATIVE: " << state << std::endl;
+			}
+		}
+	}
+
+	//Applies one block step with the block origin offset chosen by step parity. Cells obstacles.isSolid() reports are
+	//never moved or moved into.
+	template <typename Grid, typename Obstacles>
+	void apply(Grid& grid, unsigned step, const Obstacles& obstacles) const
+	{
+		int offset = step & 1;
+		for (int bx = offset; bx + 1 < grid.sizeX; bx += 2)
+		{
+			for (int by = offset; by + 1 < grid.sizeY; by += 2)
+			{
+				for (int bz = offset; bz + 1 < grid.sizeZ; bz += 2)
+				{
+					int state = 0;
+					int solid = 0;
+					for (int b = 0; b < 8; b++)
+					{
+						if (grid.containsVoxel(bx + (b & 1), by + ((b >> 1) & 1), bz + ((b >> 2) & 1)))
+							state |= 1 << b;
+						else if (obstacles.isSolid(bx + (b & 1), by + ((b >> 1) & 1), bz + ((b >> 2) & 1)))
+							solid |= 1 << b;
+					}
+					state |= solid;
+					if (state == 0 || state == 255 || state == solid)
+						continue;
+
+					int symmetry = blockHash(bx, by, bz, step) & 7;
+					if (isStill(symmetry, state) || (solid != 0 && movesAny(symmetry, state, solid)))
+						continue;
+
+					//Lift every mover out first so a destination is never a cell still waiting to move
+					const uint8_t* moves = destination[symmetry][state];
+					glm::vec3 velocities[8];
+					uint8_t materials[8];
+					for (int b = 0; b < 8; b++)
+					{
+						if ((state >> b) & 1 && moves[b] != b)
+						{
+							const voxelPosition& cell = grid.at(bx + (b & 1), by + ((b >> 1) & 1), bz + ((b >> 2) & 1));
+							velocities[b] = cell.velocity;
+							materials[b] = cell.material;
+							grid.removeVoxel(bx + (b & 1), by + ((b >> 1) & 1), bz + ((b >> 2) & 1));
+						}
+					}
+					for (int b = 0; b < 8; b++)
+					{
+						if ((state >> b) & 1 && moves[b] != b)
+						{
+							int d = moves[b];
+							grid.placeVoxel(bx + (d & 1), by + ((d >> 1) & 1), bz + ((d >> 2) & 1), velocities[b], materials[b]);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	static uint32_t blockHash(int x, int y, int z, unsigned step)
+	{
+		uint32_t h = (uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u ^ (uint32_t)z * 0xcb1ab31fu ^ step * 0x165667b1u;
+		h ^= h >> 15;
+		h *= 0x2c1b3c6du;
+		h ^= h >> 12;
+		return h;
+	}
+
+private:
+	static int cell(int dx, int dy, int dz) { return dx | (dy << 1) | (dz << 2); }
+
+	static int popCount(int state)
+	{
+		int count = 0;
+		for (; state; state &= state - 1)
+			count++;
+		return count;
+	}
+
+	//symmetry bit 0 mirrors x, bit 1 mirrors z, bit 2 swaps x and z (applied last)
+	static int transformCell(int b, int symmetry)
+	{
+		int dx = b & 1, dy = (b >> 1) & 1, dz = (b >> 2) & 1;
+		if (symmetry & 1) dx ^= 1;
+		if (symmetry & 2) dz ^= 1;
+		if (symmetry & 4) { int t = dx; dx = dz; dz = t; }
+		return cell(dx, dy, dz);
+	}
+
+	static int inverseCell(int b, int symmetry)
+	{
+		int dx = b & 1, dy = (b >> 1) & 1, dz = (b >> 2) & 1;
+		if (symmetry & 4) { int t = dx; dx = dz; dz = t; }
+		if (symmetry & 2) dz ^= 1;
+		if (symmetry & 1) dx ^= 1;
+		return cell(dx, dy, dz);
+	}
+
+	static int permuteState(int state, int symmetry)
+	{
+		int result = 0;
+		for (int b = 0; b < 8; b++)
+			if ((state >> b) & 1)
+				result |= 1 << transformCell(b, symmetry);
+		return result;
+	}
+
+	static int inversePermuteState(int state, int symmetry)
+	{
+		int result = 0;
+		for (int b = 0; b < 8; b++)
+			if ((state >> b) & 1)
+				result |= 1 << inverseCell(b, symmetry);
+		return result;
+	}
+
+	bool isStill(int symmetry, int state) const
+	{
+		return !movesAny(symmetry, state, state);
+	}
+
+	//True if the transition moves a voxel out of any of the given cells
+	bool movesAny(int symmetry, int state, int cells) const
+	{
+		for (int b = 0; b < 8; b++)
+			if ((cells >> b) & 1 && destination[symmetry][state][b] != b)
+				return true;
+		return false;
+	}
+
+	static void buildCanonical(int state, uint8_t& nextState, uint8_t* moves)
+	{
+		//occupant[c] is the source cell of the voxel that ends up in c, or -1
+		int occupant[8];
+		bool settled[8] = {};
+		for (int b = 0; b < 8; b++)
+			occupant[b] = (state >> b) & 1 ? b : -1;
+
+		auto tryMove = [&](int from, int to)
+		{
+			if (occupant[from] < 0 || settled[from] || occupant[to] >= 0)
+				return false;
+			occupant[to] = occupant[from];
+			occupant[from] = -1;
+			settled[to] = true;
+			return true;
+		};
+
+		//Fall
+		for (int dz = 0; dz < 2; dz++)
+			for (int dx = 0; dx < 2; dx++)
+				tryMove(cell(dx, 1, dz), cell(dx, 0, dz));
+
+		//Slide diagonally down
+		for (int dz = 0; dz < 2; dz++)
+			for (int dx = 0; dx < 2; dx++)
+				if (!tryMove(cell(dx, 1, dz), cell(dx ^ 1, 0, dz)))
+					tryMove(cell(dx, 1, dz), cell(dx, 0, dz ^ 1));
+
+		//Spread within each layer, bottom first
+		for (int dy = 0; dy < 2; dy++)
+			for (int dz = 0; dz < 2; dz++)
+				for (int dx = 0; dx < 2; dx++)
+					if (!tryMove(cell(dx, dy, dz), cell(dx ^ 1, dy, dz)))
+						tryMove(cell(dx, dy, dz), cell(dx, dy, dz ^ 1));
+
+		nextState = 0;
+		for (int b = 0; b < 8; b++)
+			moves[b] = (uint8_t)b;
+		for (int c = 0; c < 8; c++)
+		{
+			if (occupant[c] >= 0)
+			{
+				nextState |= 1 << c;
+				moves[occupant[c]] = (uint8_t)c;
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,408 @@
+#ifndef OBSTACLE_FIELD_H
+#define OBSTACLE_FIELD_H
+
+#include "voxelInstance.h"
+#include "jobSystem.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+//Static solid cells the fluid flows around, and a signed distance field to them built once at load time, so collision
+//tests cost one lookup instead of marching cell by cell along a move.
+//
+//distance(x, y, z) is the distance in cells from the cell centre to the nearest obstacle surface: positive in fluid,
+//negative inside obstacles. It is solved by fast sweeping (Zhao 2005) that carries closest points rather than
+//distances: every cell keeps the nearest cell on the other side of the surface, cells sharing a face with the other
+//side start with that neighbour, and Gauss-Seidel sweeps in the 8 diagonal orders let each cell take a face
+//neighbour's closest cell if it is nearer, until nothing changes. Distances from the closest cell are Euclidean, where
+//the first order eikonal update overestimates diagonal distances by a cell or more. Each sweep goes through the planes
+//x + y + z = constant in sweep order; a cell only reads neighbours on the planes either side, so every plane is split
+//across the job system (Detrixhe et al. 2013).
+//
+//Obstacle files hold one shape per line, in cell coordinates, with # starting a comment:
+//  box x0 y0 z0 x1 y1 z1       every cell in the inclusive range
+//  sphere x y z radius         every cell whose centre is within radius of (x, y, z)
+//  cell x y z
+//The domain walls stay as the rules' inline bounds checks and are not part of the field.
+
+//Stand-in for ObstacleField where rules run without obstacles, so the checks compile away
+struct noObstacles
+{
+	bool isSolid(int, int, int) const { return false; }
+	bool moveClear(int, int, int, int, int, int) const { return true; }
+	bool cubeClear(int, int, int, int) const { return true; }
+	glm::vec3 normal(int, int, int) const { return glm::vec3(0.0f); }
+};
+
+class ObstacleField
+{
+public:
+	const int sizeX;
+	const int sizeY;
+	const int sizeZ;
+
+	//Sweeps and time taken by the last buildDistanceField()
+	int sweepCount = 0;
+	double buildMilliseconds = 0;
+
+	ObstacleField(int x, int y, int z) : sizeX(x), sizeY(y), sizeZ(z), solid((size_t)x * y * z, 0) {}
+
+	//Adds the shapes in path, returning false if it can't be read. Lines that don't parse are reported and skipped.
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "ERROR::OBSTACLES::FILE_NOT_READ: " << path << std::endl;
+			return false;
+		}
+
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(file, line))
+		{
+			lineNumber++;
+			line = line.substr(0, line.find('#'));
+			std::istringstream words(line);
+			std::string shape;
+			if (!(words >> shape))
+				continue;
+
+			int x0, y0, z0, x1, y1, z1;
+			float radius;
+			if (shape == "box" && words >> x0 >> y0 >> z0 >> x1 >> y1 >> z1)
+				addBox(x0, y0, z0, x1, y1, z1);
+			else if (shape == "sphere" && words >> x0 >> y0 >> z0 >> radius)
+				addSphere(glm::vec3(x0, y0, z0), radius);
+			else if (shape == "cell" && words >> x0 >> y0 >> z0)
+				addBox(x0, y0, z0, x0, y0, z0);
+			else
+				std::cout << "ERROR::OBSTACLES::BAD_LINE: " << path << ":" << lineNumber << std::endl;
+		}
+		return true;
+	}
+
+	void addBox(int x0, int y0, int z0, int x1, int y1, int z1)
+	{
+		for (int i = std::max(0, std::min(x0, x1)); i <= std::min(sizeX - 1, std::max(x0, x1)); i++)
+			for (int j = std::max(0, std::min(y0, y1)); j <= std::min(sizeY - 1, std::max(y0, y1)); j++)
+				for (int k = std::max(0, std::min(z0, z1)); k <= std::min(sizeZ - 1, std::max(z0, z1)); k++)
+					markSolid(i, j, k);
+	}
+
+	void addSphere(glm::vec3 centre, float radius)
+	{
+		for (int i = std::max(0, (int)std::floor(centre.x - radius)); i <= std::min(sizeX - 1, (int)std::ceil(centre.x + radius)); i++)
+			for (int j = std::max(0, (int)std::floor(centre.y - radius)); j <= std::min(sizeY - 1, (int)std::ceil(centre.y + radius)); j++)
+				for (int k = std::max(0, (int)std::floor(centre.z - radius)); k <= std::min(sizeZ - 1, (int)std::ceil(centre.z + radius)); k++)
+					if (glm::dot(glm::vec3(i, j, k) - centre, glm::vec3(i, j, k) - centre) <= radius * radius)
+						markSolid(i, j, k);
+	}
+
+	bool empty() const { return solidCount == 0; }
+	long long solidCellCount() const { return solidCount; }
+
+	//False outside the domain, which the rules bound themselves
+	bool isSolid(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return false;
+		return solid[index(x, y, z)] != 0;
+	}
+
+	//Signed distance in cells to the nearest obstacle surface; very large with no obstacles or before the field is built
+	float distance(int x, int y, int z) const
+	{
+		if (distances.empty())
+			return farAway();
+		x = std::min(std::max(x, 0), sizeX - 1);
+		y = std::min(std::max(y, 0), sizeY - 1);
+		z = std::min(std::max(z, 0), sizeZ - 1);
+		return distances[index(x, y, z)];
+	}
+
+	//Unit vector pointing away from the nearest obstacle, from central differences of the field; zero where it is flat
+	glm::vec3 normal(int x, int y, int z) const
+	{
+		glm::vec3 gradient(distance(x + 1, y, z) - distance(x - 1, y, z), distance(x, y + 1, z) - distance(x, y - 1, z),
+			distance(x, y, z + 1) - distance(x, y, z - 1));
+		float length = glm::length(gradient);
+		return length > 1e-6f ? gradient / length : glm::vec3(0.0f);
+	}
+
+	//True if a voxel moving from cell (x, y, z) by (dx, dy, dz) cannot enter or pass through an obstacle: the target is
+	//not solid, and either it is a neighbouring cell or the start is farther from every obstacle than the move is long.
+	//One lookup in the field, however long the move. One cell of slack covers obstacle corners, which are up to
+	//sqrt(3)/2 from their centre where the field assumes 1/2, and the about half a cell by which a closest cell that
+	//sweeping only passes along faces can be off (--check-distance-field measures it).
+	bool moveClear(int x, int y, int z, int dx, int dy, int dz) const
+	{
+		if (isSolid(x + dx, y + dy, z + dz))
+			return false;
+		if (std::abs(dx) <= 1 && std::abs(dy) <= 1 && std::abs(dz) <= 1)
+			return true;
+		return distance(x, y, z) > std::sqrt((float)(dx * dx + dy * dy + dz * dz)) + 1.0f;
+	}
+
+	//True if no cell of the cube with corner cell (x, y, z) and side span cells is solid, from one lookup at its centre:
+	//the centre cell is farther from every obstacle than the cube's farthest cell centre, with the slack moveClear uses
+	bool cubeClear(int x, int y, int z, int span) const
+	{
+		int half = span / 2;
+		return distance(x + half, y + half, z + half) > std::sqrt(3.0f) * (float)half + 1.0f;
+	}
+
+	//Solves the signed distance field from the current solid cells
+	void buildDistanceField(JobSystem& jobs)
+	{
+		auto start = std::chrono::steady_clock::now();
+		distances.assign(solid.size(), farAway());
+		closest.assign(solid.size(), closestCell());
+		sweepCount = 0;
+		if (solidCount > 0)
+		{
+			for (int i = 0; i < sizeX; i++)
+				for (int j = 0; j < sizeY; j++)
+					for (int k = 0; k < sizeZ; k++)
+						seedFromSurface(i, j, k);
+
+			//Done once all 8 orders in a row change nothing, usually after two rounds; the cap only guards against shapes
+			//that keep trading closest cells
+			int quietSweeps = 0;
+			for (int direction = 0; quietSweeps < 8 && sweepCount < 16 * 8; direction = (direction + 1) & 7)
+			{
+				quietSweeps = sweep(jobs, direction) ? 0 : quietSweeps + 1;
+				sweepCount++;
+			}
+
+			//Centre to centre, less the half cell to the surface between them
+			for (size_t c = 0; c < solid.size(); c++)
+			{
+				if (closest[c].cell == noCell())
+					continue;
+				float toSurface = std::sqrt((float)closest[c].squared) - 0.5f;
+				distances[c] = solid[c] ? -toSurface : toSurface;
+			}
+		}
+		buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	//How the field compares with a brute-force distance to the nearest cell on the other side of the surface
+	struct fieldCheck
+	{
+		long long cells = 0;
+		//Cells within 1e-4 of the brute-force distance
+		long long exact = 0;
+		float largestError = 0;
+	};
+
+	//Compares every cell's distance with a brute-force search over every surface cell on the other side, to re-verify
+	//the closest-point sweeping. Costs cells times surface cells, so it is only meant for checks.
+	fieldCheck checkAgainstBruteForce(JobSystem& jobs) const
+	{
+		fieldCheck result;
+		if (solidCount == 0 || distances.empty())
+			return result;
+
+		//The nearest cell on the other side always has a face neighbour on this side: any other cell has a neighbour on
+		//its own side that is nearer. So only cells seeded from the surface need searching.
+		std::vector<uint32_t> surface[2];
+		const int offsets[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		for (int x = 0; x < sizeX; x++)
+		{
+			for (int y = 0; y < sizeY; y++)
+			{
+				for (int z = 0; z < sizeZ; z++)
+				{
+					uint8_t side = solid[index(x, y, z)];
+					for (int n = 0; n < 6; n++)
+					{
+						int nx = x + offsets[n][0], ny = y + offsets[n][1], nz = z + offsets[n][2];
+						if (nx >= 0 && ny >= 0 && nz >= 0 && nx < sizeX && ny < sizeY && nz < sizeZ && solid[index(nx, ny, nz)] != side)
+						{
+							surface[side].push_back(packVoxel(x, y, z));
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		WorkerLocal<fieldCheck> partial(jobs);
+		jobs.parallelFor(0, sizeX, [&](int begin, int end, int worker)
+		{
+			fieldCheck& local = partial[worker];
+			for (int x = begin; x < end; x++)
+			{
+				for (int y = 0; y < sizeY; y++)
+				{
+					for (int z = 0; z < sizeZ; z++)
+					{
+						size_t cell = index(x, y, z);
+						const std::vector<uint32_t>& otherSide = surface[solid[cell] ? 0 : 1];
+						if (otherSide.empty())
+							continue;
+						int nearest = INT32_MAX;
+						for (uint32_t candidate : otherSide)
+						{
+							int cx = candidate & PACKED_COORD_MASK, cy = (candidate >> PACKED_COORD_BITS) & PACKED_COORD_MASK;
+							int cz = (candidate >> (2 * PACKED_COORD_BITS)) & PACKED_COORD_MASK;
+							nearest = std::min(nearest, (cx - x) * (cx - x) + (cy - y) * (cy - y) + (cz - z) * (cz - z));
+						}
+						float expected = std::sqrt((float)nearest) - 0.5f;
+						float error = std::abs(distances[cell] - (solid[cell] ? -expected : expected));
+						local.cells++;
+						local.exact += error < 1e-4f ? 1 : 0;
+						local.largestError = std::max(local.largestError, error);
+					}
+				}
+			}
+		});
+		for (int worker = 0; worker < partial.size(); worker++)
+		{
+			result.cells += partial[worker].cells;
+			result.exact += partial[worker].exact;
+			result.largestError = std::max(result.largestError, partial[worker].largestError);
+		}
+		return result;
+	}
+
+	//Solid cells with at least one face open to fluid or the domain edge, packed for drawing (see voxelInstance.h).
+	//Fully enclosed cells can't be seen and are left out.
+	std::vector<packedVoxel> visibleCells() const
+	{
+		std::vector<packedVoxel> cells;
+		for (int i = 0; i < sizeX; i++)
+			for (int j = 0; j < sizeY; j++)
+				for (int k = 0; k < sizeZ; k++)
+					if (isSolid(i, j, k) && !(isSolid(i - 1, j, k) && isSolid(i + 1, j, k) && isSolid(i, j - 1, k) && isSolid(i, j + 1, k)
+						&& isSolid(i, j, k - 1) && isSolid(i, j, k + 1)))
+						cells.push_back(packVoxel(i, j, k));
+		return cells;
+	}
+
+private:
+	enum { MIN_PIECE = 4 };
+	static uint32_t noCell() { return 0xFFFFFFFFu; }
+
+	std::vector<uint8_t> solid;
+	std::vector<float> distances;
+	//While building: the nearest cell on the other side of the surface, packed as in voxelInstance.h with the material
+	//bits saying whether it is solid, and its squared distance in cells. Kept together so a neighbour costs one load.
+	struct closestCell
+	{
+		uint32_t cell = noCell();
+		int32_t squared = INT32_MAX;
+	};
+	std::vector<closestCell> closest;
+	long long solidCount = 0;
+
+	size_t index(int x, int y, int z) const { return ((size_t)x * sizeY + y) * sizeZ + z; }
+
+	static float farAway() { return 1e30f; }
+
+	void markSolid(int x, int y, int z)
+	{
+		uint8_t& cell = solid[index(x, y, z)];
+		solidCount += cell ? 0 : 1;
+		cell = 1;
+	}
+
+	//A cell with a face neighbour on the other side of the surface starts with that neighbour as its closest cell
+	void seedFromSurface(int x, int y, int z)
+	{
+		size_t cell = index(x, y, z);
+		const int offsets[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		for (int n = 0; n < 6; n++)
+		{
+			int nx = x + offsets[n][0], ny = y + offsets[n][1], nz = z + offsets[n][2];
+			if (nx < 0 || ny < 0 || nz < 0 || nx >= sizeX || ny >= sizeY || nz >= sizeZ)
+				continue;
+			if (solid[index(nx, ny, nz)] != solid[cell])
+			{
+				closest[cell].cell = packVoxel(nx, ny, nz, solid[cell] ? 0 : 1);
+				closest[cell].squared = 1;
+				return;
+			}
+		}
+	}
+
+	//Takes a face neighbour's closest cell if it is nearer than this cell's own. Neighbours across the surface have
+	//closest cells on this cell's side, so only closest cells on the other side are looked at.
+	bool improveFromNeighbours(int x, int y, int z)
+	{
+		size_t cell = index(x, y, z);
+		uint32_t otherSide = solid[cell] ? 0 : 1;
+		closestCell best = closest[cell];
+		const int offsets[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		for (int n = 0; n < 6; n++)
+		{
+			int nx = x + offsets[n][0], ny = y + offsets[n][1], nz = z + offsets[n][2];
+			if (nx < 0 || ny < 0 || nz < 0 || nx >= sizeX || ny >= sizeY || nz >= sizeZ)
+				continue;
+			uint32_t candidate = closest[index(nx, ny, nz)].cell;
+			if (candidate == noCell() || candidate == best.cell || (candidate >> PACKED_MATERIAL_SHIFT) != otherSide)
+				continue;
+
+			int cx = candidate & PACKED_COORD_MASK, cy = (candidate >> PACKED_COORD_BITS) & PACKED_COORD_MASK;
+			int cz = (candidate >> (2 * PACKED_COORD_BITS)) & PACKED_COORD_MASK;
+			int squared = (cx - x) * (cx - x) + (cy - y) * (cy - y) + (cz - z) * (cz - z);
+			if (squared < best.squared)
+			{
+				best.cell = candidate;
+				best.squared = squared;
+			}
+		}
+		if (best.cell == closest[cell].cell)
+			return false;
+		closest[cell] = best;
+		return true;
+	}
+
+	//One Gauss-Seidel sweep in the order given by the three bits of direction (set bits run that axis downwards),
+	//returning true if any cell found a nearer closest cell
+	bool sweep(JobSystem& jobs, int direction)
+	{
+		bool flipX = direction & 1, flipY = (direction >> 1) & 1, flipZ = (direction >> 2) & 1;
+		std::atomic<bool> changed{ false };
+		int workers = jobs.workerCount();
+
+		for (int plane = 0; plane <= (sizeX - 1) + (sizeY - 1) + (sizeZ - 1); plane++)
+		{
+			int firstX = std::max(0, plane - (sizeY - 1) - (sizeZ - 1));
+			int lastX = std::min(sizeX - 1, plane);
+			int grain = std::max((int)MIN_PIECE, (lastX - firstX + 4 * workers) / (4 * workers));
+			jobs.parallelFor(firstX, lastX + 1, grain, [&](int begin, int end, int)
+			{
+				bool improved = false;
+				for (int sx = begin; sx < end; sx++)
+				{
+					int firstY = std::max(0, plane - sx - (sizeZ - 1));
+					int lastY = std::min(sizeY - 1, plane - sx);
+					for (int sy = firstY; sy <= lastY; sy++)
+					{
+						int sz = plane - sx - sy;
+						int x = flipX ? sizeX - 1 - sx : sx;
+						int y = flipY ? sizeY - 1 - sy : sy;
+						int z = flipZ ? sizeZ - 1 - sz : sz;
+						if (improveFromNeighbours(x, y, z))
+							improved = true;
+					}
+				}
+				if (improved)
+					changed.store(true, std::memory_order_relaxed);
+			});
+		}
+		return changed.load();
+	}
+};
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef OCCUPANCY_PYRAMID_H
+#define OCCUPANCY_PYRAMID_H
+
+#include "voxelGrid.h"
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <climits>
+
+//Mip pyramid of voxel counts over a grid. Level 0 is the grid itself; a cell at level L covers a 2^L cube of level 0
+//cells and stores how many of them hold a voxel. Levels are added until every axis is down to one cell. The counts are
+//updated per voxel through add()/remove()/move() (PyramidTrackedGrid below does that automatically). A move only touches
+//the levels below the first one where source and target share a cell, which for a move to a neighbour is usually one or
+//two.
+
+class OccupancyPyramid
+{
+public:
+	OccupancyPyramid(int x, int y, int z) : sizeX(x), sizeY(y), sizeZ(z)
+	{
+		levelSizes.push_back(vec3Int(x, y, z));
+		counts.emplace_back();
+		while (levelSizes.back().x > 1 || levelSizes.back().y > 1 || levelSizes.back().z > 1)
+		{
+			vec3Int previous = levelSizes.back();
+			levelSizes.push_back(vec3Int((previous.x + 1) / 2, (previous.y + 1) / 2, (previous.z + 1) / 2));
+			counts.emplace_back((size_t)levelSizes.back().x * levelSizes.back().y * levelSizes.back().z, 0);
+		}
+	}
+
+	//Number of levels including level 0
+	int levelCount() const { return (int)levelSizes.size(); }
+
+	vec3Int levelSize(int level) const { return levelSizes[level]; }
+
+	//Voxels inside a cell at level >= 1
+	uint32_t count(int level, int x, int y, int z) const { return counts[level][index(level, x, y, z)]; }
+
+	//Level 0 cells a cell covers, fewer than 8^level where it overhangs the domain edge
+	int cellVolume(int level, int x, int y, int z) const
+	{
+		int span = 1 << level;
+		return (std::min(sizeX, (x + 1) * span) - x * span) * (std::min(sizeY, (y + 1) * span) - y * span) * (std::min(sizeZ, (z + 1) * span) - z * span);
+	}
+
+	void add(int x, int y, int z)
+	{
+		for (int level = 1; level < levelCount(); level++)
+			counts[level][index(level, x >> level, y >> level, z >> level)]++;
+	}
+
+	void remove(int x, int y, int z)
+	{
+		for (int level = 1; level < levelCount(); level++)
+			counts[level][index(level, x >> level, y >> level, z >> level)]--;
+	}
+
+	void move(int fromX, int fromY, int fromZ, int toX, int toY, int toZ)
+	{
+		for (int level = 1; level < levelCount(); level++)
+		{
+			size_t from = index(level, fromX >> level, fromY >> level, fromZ >> level);
+			size_t to = index(level, toX >> level, toY >> level, toZ >> level);
+			if (from == to)
+				break;
+			counts[level][from]--;
+			counts[level][to]++;
+		}
+	}
+
+	template <typename Grid>
+	void rebuild(const Grid& grid)
+	{
+		for (int level = 1; level < levelCount(); level++)
+			std::fill(counts[level].begin(), counts[level].end(), 0);
+		grid.forEachVoxel([&](int x, int y, int z, const voxelPosition&)
+		{
+			add(x, y, z);
+		});
+	}
+
+	bool operator==(const OccupancyPyramid& other) const { return counts == other.counts; }
+
+	size_t memoryBytes() const
+	{
+		size_t bytes = 0;
+		for (const std::vector<uint32_t>& level : counts)
+			bytes += level.size() * sizeof(uint32_t);
+		return bytes;
+	}
+
+private:
+	int sizeX, sizeY, sizeZ;
+	std::vector<vec3Int> levelSizes;
+	//counts[0] stays empty, level 0 is read from the grid
+	std::vector<std::vector<uint32_t>> counts;
+
+	size_t index(int level, int x, int y, int z) const
+	{
+		const vec3Int& size = levelSizes[level];
+		return ((size_t)x * size.y + y) * size.z + z;
+	}
+};
+
+//Grid interface from voxelGrid.h over another layout, keeping an OccupancyPyramid in step with every placed and removed
+//voxel
+template <typename Grid>
+class PyramidTrackedGrid
+{
+public:
+	const int sizeX;
+	const int sizeY;
+	const int sizeZ;
+
+	PyramidTrackedGrid(int x, int y, int z) : sizeX(x), sizeY(y), sizeZ(z), grid(x, y, z), occupancy(x, y, z) {}
+
+	bool containsVoxel(int x, int y, int z) const { return grid.containsVoxel(x, y, z); }
+
+	voxelPosition& at(int x, int y, int z) { return grid.at(x, y, z); }
+
+	uint8_t materialAt(int x, int y, int z) const { return grid.materialAt(x, y, z); }
+
+	void placeVoxel(int x, int y, int z, glm::vec3 velocity = glm::vec3(0.0f), uint8_t material = MATERIAL_WATER)
+	{
+		if (!grid.containsVoxel(x, y, z))
+			occupancy.add(x, y, z);
+		grid.placeVoxel(x, y, z, velocity, material);
+	}
+
+	void removeVoxel(int x, int y, int z)
+	{
+		if (grid.containsVoxel(x, y, z))
+			occupancy.remove(x, y, z);
+		grid.removeVoxel(x, y, z);
+	}
+
+	//Moves the voxel at from into the free cell to, keeping its velocity and material. A target outside the grid has no
+	//pyramid cell to count it in, so the voxel stays where it is.
+	void moveVoxel(vec3Int from, vec3Int to)
+	{
+		if (to.x < 0 || to.y < 0 || to.z < 0 || to.x >= sizeX || to.y >= sizeY || to.z >= sizeZ)
+			return;
+		voxelPosition cell = grid.at(from.x, from.y, from.z);
+		grid.placeVoxel(to.x, to.y, to.z, cell.velocity, cell.material);
+		grid.removeVoxel(from.x, from.y, from.z);
+		occupancy.move(from.x, from.y, from.z, to.x, to.y, to.z);
+	}
+
+	template <typename F>
+	void sweep(F f) { grid.sweep(f); }
+
+	template <typename F>
+	void forEachVoxel(F f) const { grid.forEachVoxel(f); }
+
+	size_t memoryBytes() const { return grid.memoryBytes() + occupancy.memoryBytes(); }
+
+	const OccupancyPyramid& pyramid() const { return occupancy; }
+
+	//For kernels that change the wrapped grid directly; rebuildPyramid() must follow
+	Grid& inner() { return grid; }
+	const Grid& inner() const { return grid; }
+
+	void rebuildPyramid() { occupancy.rebuild(grid); }
+
+private:
+	Grid grid;
+	OccupancyPyramid occupancy;
+};
+
+template <typename Grid>
+struct concurrentReads<PyramidTrackedGrid<Grid>> { enum { value = concurrentReads<Grid>::value }; };
+
+//Camera and screen parameters for picking a level of detail
+struct lodView
+{
+	glm::vec3 cameraPosition;
+	float voxelSpacing;
+	//Screen pixels covered by one world unit at distance one: viewport height / (2 * tan(fov / 2))
+	float pixelsPerUnit;
+	//Cells are merged until they cover about this many pixels
+	float targetPixels;
+	//Chunks are cells of this level; each chunk draws all of its cells at one level no coarser than the chunk itself
+	int chunkLevel;
+};
+
+//Number of chunks selectLodCells walks, numbered x slowest and z fastest
+inline int lodChunkCount(const OccupancyPyramid& pyramid, const lodView& view)
+{
+	vec3Int chunks = pyramid.levelSize(std::min(view.chunkLevel, pyramid.levelCount() - 1));
+	return chunks.x * chunks.y * chunks.z;
+}
+
+//Calls emit(level, x, y, z) for every cell to draw. Each nonempty chunk picks the level at which a cell covers about
+//targetPixels at the distance of the chunk's nearest point, then descends the pyramid to that level, skipping empty
+//cells. Level 0 cells are drawn if they hold a voxel; coarser cells if at least half of the cells they cover do.
+//Chunks are independent, so disjoint [firstChunk, lastChunk) ranges can be selected in parallel when the grid allows
+//concurrent reads.
+template <typename Grid, typename F>
+void selectLodCells(const Grid& grid, const OccupancyPyramid& pyramid, const lodView& view, F emit, int firstChunk = 0, int lastChunk = INT_MAX)
+{
+	int chunkLevel = std::min(view.chunkLevel, pyramid.levelCount() - 1);
+	vec3Int chunks = pyramid.levelSize(chunkLevel);
+	int chunkSpan = 1 << chunkLevel;
+
+	//Visits the cells of cell (x, y, z) at level that lie at targetLevel
+	auto descend = [&](auto& self, int level, int x, int y, int z, int targetLevel) -> void
+	{
+		if (level == 0)
+		{
+			if (grid.containsVoxel(x, y, z))
+				emit(0, x, y, z);
+			return;
+		}
+		uint32_t voxels = pyramid.count(level, x, y, z);
+		if (voxels == 0)
+			return;
+		if (level == targetLevel)
+		{
+			if (voxels * 2 >= (uint32_t)pyramid.cellVolume(level, x, y, z))
+				emit(level, x, y, z);
+			return;
+		}
+
+		vec3Int childSize = pyramid.levelSize(level - 1);
+		for (int cx = 2 * x; cx < std::min(2 * x + 2, childSize.x); cx++)
+		{
+			for (int cy = 2 * y; cy < std::min(2 * y + 2, childSize.y); cy++)
+			{
+				for (int cz = 2 * z; cz < std::min(2 * z + 2, childSize.z); cz++)
+				{
+					if (level == 1)
+					{
+						if (grid.containsVoxel(cx, cy, cz))
+							emit(0, cx, cy, cz);
+					}
+					else
+					{
+						self(self, level - 1, cx, cy, cz, targetLevel);
+					}
+				}
+			}
+		}
+	};
+
+	lastChunk = std::min(lastChunk, chunks.x * chunks.y * chunks.z);
+	for (int chunk = firstChunk; chunk < lastChunk; chunk++)
+	{
+		int x = chunk / (chunks.y * chunks.z);
+		int y = (chunk / chunks.z) % chunks.y;
+		int z = chunk % chunks.z;
+		if (chunkLevel > 0 && pyramid.count(chunkLevel, x, y, z) == 0)
+			continue;
+
+		//Nearest point of the chunk's box to the camera
+		glm::vec3 low = glm::vec3((float)(x * chunkSpan), (float)(y * chunkSpan), (float)(z * chunkSpan)) * view.voxelSpacing;
+		glm::vec3 high = glm::vec3((float)((x + 1) * chunkSpan - 1), (float)((y + 1) * chunkSpan - 1), (float)((z + 1) * chunkSpan - 1)) * view.voxelSpacing;
+		float dx = std::max(std::max(low.x - view.cameraPosition.x, view.cameraPosition.x - high.x), 0.0f);
+		float dy = std::max(std::max(low.y - view.cameraPosition.y, view.cameraPosition.y - high.y), 0.0f);
+		float dz = std::max(std::max(low.z - view.cameraPosition.z, view.cameraPosition.z - high.z), 0.0f);
+		float distance = std::max(std::sqrt(dx * dx + dy * dy + dz * dz), 1.0f);
+
+		float voxelPixels = view.voxelSpacing * view.pixelsPerUnit / distance;
+		int level = 0;
+		while (level < chunkLevel && voxelPixels * (float)(2 << level) <= view.targetPixels)
+			level++;
+
+		descend(descend, chunkLevel, x, y, z, level);
+	}
+}
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef OFFSCREEN_RENDERER_H
+#define OFFSCREEN_RENDERER_H
+
+#include <glad/glad.h>
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#include <GLFW/glfw3.h>
+#endif
+#include "imageWriter.h"
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+//Rendering without a window, for machines that have no display. OffscreenContext makes a GL context current with
+//nothing to present to: a surfaceless EGL context on Linux (Mesa's surfaceless platform when available, so no X or
+//Wayland server is needed), and an invisible GLFW window elsewhere. FrameCapture is the framebuffer to draw into and
+//reads every frame back to disk.
+
+class OffscreenContext
+{
+public:
+	bool valid = false;
+
+	OffscreenContext()
+	{
+#if defined(__linux__)
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+		{
+			std::cout << "ERROR::OFFSCREEN::EGL_DISPLAY_FAILED" << std::endl;
+			return;
+		}
+
+		//No surface is ever created, so any surface type will do (the default asks for window support)
+		const EGLint configAttributes[] = { EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLConfig config;
+		EGLint configCount = 0;
+		eglBindAPI(EGL_OPENGL_API);
+		if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+		{
+			std::cout << "ERROR::OFFSCREEN::EGL_NO_CONFIG" << std::endl;
+			return;
+		}
+
+		//Same version and profile as the window
+		const EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 6,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		{
+			std::cout << "ERROR::OFFSCREEN::EGL_CONTEXT_FAILED" << std::endl;
+			return;
+		}
+		valid = gladLoadGLLoader((GLADloadproc)eglGetProcAddress) != 0;
+#else
+		glfwInit();
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(1, 1, "Voxels", NULL, NULL);
+		if (window == NULL)
+		{
+			std::cout << "ERROR::OFFSCREEN::HIDDEN_WINDOW_FAILED" << std::endl;
+			return;
+		}
+		glfwMakeContextCurrent(window);
+		valid = gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) != 0;
+#endif
+		if (!valid)
+			std::cout << "ERROR::OFFSCREEN::GLAD_FAILED" << std::endl;
+	}
+
+	~OffscreenContext()
+	{
+#if defined(__linux__)
+		if (context != EGL_NO_CONTEXT)
+		{
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(display, context);
+		}
+		if (display != EGL_NO_DISPLAY)
+			eglTerminate(display);
+#else
+		glfwTerminate();
+#endif
+	}
+
+private:
+#if defined(__linux__)
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#else
+	GLFWwindow* window = NULL;
+#endif
+};
+
+//A colour and depth framebuffer of the requested size, read back through a ring of RING pixel buffer objects.
+//capture() only queues glReadPixels into the next buffer and fences it; the buffer is mapped RING - 1 frames later,
+//when the GPU has long finished with it, so the CPU rarely waits for the copy. Mapped frames are flipped to top row
+//first and written on a background thread while the next frames render. format is "ppm", "png" or "none".
+class FrameCapture
+{
+public:
+	enum { RING = 3 };
+
+	//Milliseconds spent waiting for readbacks and for the previous file write to finish
+	double waitMilliseconds = 0;
+	int framesCaptured = 0;
+
+	//Needs a current context
+	FrameCapture(int width, int height, const std::string& format) : width(width), height(height), format(format)
+	{
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glGenRenderbuffers(2, renderbuffers);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::OFFSCREEN::FRAMEBUFFER_INCOMPLETE" << std::endl;
+
+		glGenBuffers(RING, PBOs);
+		for (int i = 0; i < RING; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, PBOs[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, NULL, GL_STREAM_READ);
+			fences[i] = 0;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glViewport(0, 0, width, height);
+	}
+
+	~FrameCapture()
+	{
+		if (writer.joinable())
+			writer.join();
+	}
+
+	//Queues the readback of the frame just drawn
+	void capture()
+	{
+		int slot = queuedFrames % RING;
+		//The slot's previous frame has to be out before it is reused
+		if (queuedFrames >= RING)
+			retrieve(slot);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, PBOs[slot]);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slotFrame[slot] = queuedFrames++;
+	}
+
+	//Retrieves every frame still in the ring and waits for the last write
+	void finish()
+	{
+		for (int frame = std::max(0, queuedFrames - RING); frame < queuedFrames; frame++)
+			retrieve(frame % RING);
+		if (writer.joinable())
+			writer.join();
+	}
+
+private:
+	int width, height;
+	std::string format;
+	unsigned int FBO;
+	unsigned int renderbuffers[2];
+	unsigned int PBOs[RING];
+	GLsync fences[RING];
+	int slotFrame[RING];
+	int queuedFrames = 0;
+	std::vector<uint8_t> pending;
+	std::vector<uint8_t> writing;
+	std::thread writer;
+
+	void retrieve(int slot)
+	{
+		if (fences[slot] == 0)
+			return;
+		auto start = std::chrono::steady_clock::now();
+		glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(fences[slot]);
+		fences[slot] = 0;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, PBOs[slot]);
+		const uint8_t* pixels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)width * height * 4, GL_MAP_READ_BIT);
+		if (pixels && format != "none")
+		{
+			//GL rows start at the bottom
+			pending.resize((size_t)width * height * 3);
+			for (int y = 0; y < height; y++)
+			{
+				const uint8_t* in = pixels + (size_t)(height - 1 - y) * width * 4;
+				uint8_t* out = &pending[(size_t)y * width * 3];
+				for (int x = 0; x < width; x++)
+				{
+					out[x * 3] = in[x * 4];
+					out[x * 3 + 1] = in[x * 4 + 1];
+					out[x * 3 + 2] = in[x * 4 + 2];
+				}
+			}
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (format != "none")
+		{
+			if (writer.joinable())
+				writer.join();
+			std::swap(pending, writing);
+			char path[64];
+			snprintf(path, sizeof(path), "frame_%04d.%s", slotFrame[slot], format.c_str());
+			std::string file = path;
+			writer = std::thread([this, file]()
+			{
+				if (format == "png")
+					writePNG(file.c_str(), width, height, writing.data());
+				else
+					writePPM(file.c_str(), width, height, writing.data());
+			});
+		}
+		framesCaptured++;
+		waitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+#endif
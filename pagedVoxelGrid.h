@@ -0,0 +1,413 @@
+#ifndef PAGED_VOXEL_GRID_H
+#define PAGED_VOXEL_GRID_H
+
+#include "voxelGrid.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+//A dense grid split into 32^3 chunks of which only a bounded number are resident. The least recently used chunk is
+//written to a page file when the budget is exceeded and read back on the next access. A background thread reads
+//chunks next to the ones being swept ahead of time, so most page-ins do not stall the simulation.
+//Chunks that hold no voxels are never read or written; they are recreated empty on access.
+//Implements the grid interface from voxelGrid.h. References returned by at() stay valid until the chunk is evicted,
+//which cannot happen while it is among the most recently used chunks, so keep maxResidentChunks at 8 or more.
+
+class PagedVoxelGrid
+{
+public:
+	static const int CHUNK_LOG2 = 5;
+	static const int CHUNK_DIM = 1 << CHUNK_LOG2;
+	static const int CHUNK_CELLS = CHUNK_DIM * CHUNK_DIM * CHUNK_DIM;
+
+	struct PagingStats
+	{
+		size_t pageIns = 0;
+		size_t pageOuts = 0;
+		size_t prefetchesIssued = 0;
+		size_t prefetchHits = 0;
+		double stallSeconds = 0;
+	};
+
+	const int sizeX;
+	const int sizeY;
+	const int sizeZ;
+
+	PagedVoxelGrid(int x, int y, int z, size_t maxResidentChunks = 256, const std::string& pageFilePath = "voxelPages.bin")
+		: sizeX(x), sizeY(y), sizeZ(z), maxResident(maxResidentChunks < 8 ? 8 : maxResidentChunks), path(pageFilePath)
+	{
+		chunksX = (x + CHUNK_DIM - 1) / CHUNK_DIM;
+		chunksY = (y + CHUNK_DIM - 1) / CHUNK_DIM;
+		chunksZ = (z + CHUNK_DIM - 1) / CHUNK_DIM;
+		size_t chunkCount = (size_t)chunksX * chunksY * chunksZ;
+		chunkVoxelCount.assign(chunkCount, 0);
+		onDisk.assign(chunkCount, 0);
+		version.assign(chunkCount, 0);
+
+		file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file)
+			std::cout << "ERROR::PAGED_GRID::PAGE_FILE_NOT_OPENED: " << path << std::endl;
+		worker = std::thread(&PagedVoxelGrid::prefetchLoop, this);
+	}
+
+	~PagedVoxelGrid()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+		file.close();
+		std::remove(path.c_str());
+	}
+
+	PagedVoxelGrid(const PagedVoxelGrid&) = delete;
+	PagedVoxelGrid& operator=(const PagedVoxelGrid&) = delete;
+
+	bool containsVoxel(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return false;
+		if (chunkVoxelCount[chunkId(x, y, z)] == 0)
+			return false;
+		return acquire(chunkId(x, y, z))->cells[cellIndex(x, y, z)].containsVoxel;
+	}
+
+	voxelPosition& at(int x, int y, int z)
+	{
+		return acquire(chunkId(x, y, z))->cells[cellIndex(x, y, z)];
+	}
+
+	uint8_t materialAt(int x, int y, int z) const
+	{
+		if (!containsVoxel(x, y, z))
+			return MATERIAL_EMPTY;
+		return acquire(chunkId(x, y, z))->cells[cellIndex(x, y, z)].material;
+	}
+
+	void placeVoxel(int x, int y, int z, glm::vec3 velocity = glm::vec3(0.0f), uint8_t material = MATERIAL_WATER)
+	{
+		int id = chunkId(x, y, z);
+		Chunk* chunk = acquire(id);
+		voxelPosition& cell = chunk->cells[cellIndex(x, y, z)];
+		if (!cell.containsVoxel)
+			chunkVoxelCount[id]++;
+		cell.containsVoxel = true;
+		cell.material = material;
+		cell.velocity = velocity;
+		chunk->dirty = true;
+	}
+
+	void removeVoxel(int x, int y, int z)
+	{
+		int id = chunkId(x, y, z);
+		Chunk* chunk = acquire(id);
+		voxelPosition& cell = chunk->cells[cellIndex(x, y, z)];
+		if (cell.containsVoxel)
+			chunkVoxelCount[id]--;
+		cell = voxelPosition();
+		chunk->dirty = true;
+	}
+
+	//Visits occupied chunks in order, prefetching the next one and its face neighbours while the current one is swept
+	template <typename F>
+	void sweep(F f)
+	{
+		std::vector<int>& active = sweepChunks;
+		activeChunks(active);
+		for (size_t a = 0; a < active.size(); a++)
+		{
+			if (a + 1 < active.size())
+				prefetchAround(active[a + 1]);
+
+			int cx, cy, cz;
+			chunkCoords(active[a], cx, cy, cz);
+			int endX = std::min(sizeX, (cx + 1) * CHUNK_DIM);
+			int endY = std::min(sizeY, (cy + 1) * CHUNK_DIM);
+			int endZ = std::min(sizeZ, (cz + 1) * CHUNK_DIM);
+			for (int i = cx * CHUNK_DIM; i < endX; i++)
+				for (int j = cy * CHUNK_DIM; j < endY; j++)
+					for (int k = cz * CHUNK_DIM; k < endZ; k++)
+						if (containsVoxel(i, j, k))
+							f(i, j, k);
+		}
+	}
+
+	template <typename F>
+	void forEachVoxel(F f) const
+	{
+		std::vector<int>& active = visitChunks;
+		activeChunks(active);
+		for (size_t a = 0; a < active.size(); a++)
+		{
+			if (a + 1 < active.size())
+				prefetch(active[a + 1]);
+
+			int cx, cy, cz;
+			chunkCoords(active[a], cx, cy, cz);
+			const Chunk* chunk = acquire(active[a]);
+			for (int n = 0; n < CHUNK_CELLS; n++)
+			{
+				if (chunk->cells[n].containsVoxel)
+					f(cx * CHUNK_DIM + (n >> (2 * CHUNK_LOG2)), cy * CHUNK_DIM + ((n >> CHUNK_LOG2) & (CHUNK_DIM - 1)), cz * CHUNK_DIM + (n & (CHUNK_DIM - 1)), chunk->cells[n]);
+			}
+		}
+	}
+
+	//Bytes of resident chunk data, not counting the page file
+	size_t memoryBytes() const
+	{
+		return resident.size() * CHUNK_CELLS * sizeof(voxelPosition) + chunkVoxelCount.size() * (sizeof(int) + sizeof(char) + sizeof(unsigned));
+	}
+
+	size_t residentChunkCount() const { return resident.size(); }
+
+	const PagingStats& stats() const { return pagingStats; }
+
+	void resetStats() { pagingStats = PagingStats(); }
+
+private:
+	struct Chunk
+	{
+		std::vector<voxelPosition> cells;
+		bool dirty = false;
+		std::list<int>::iterator lruPosition;
+	};
+
+	int chunksX, chunksY, chunksZ;
+	size_t maxResident;
+	std::string path;
+
+	//Main thread only
+	mutable std::unordered_map<int, std::unique_ptr<Chunk>> resident;
+	mutable std::list<int> lru;
+	mutable int cachedId = -1;
+	mutable Chunk* cachedChunk = nullptr;
+	mutable std::fstream file;
+	mutable PagingStats pagingStats;
+	std::vector<int> chunkVoxelCount;
+	//Active chunk lists kept between calls, so steps don't allocate
+	std::vector<int> sweepChunks;
+	mutable std::vector<int> visitChunks;
+
+	//Shared with the prefetch thread, guarded by mutex. version is odd while a chunk is being written.
+	mutable std::mutex mutex;
+	mutable std::condition_variable wake;
+	mutable std::deque<int> prefetchQueue;
+	mutable std::unordered_map<int, std::vector<voxelPosition>> ready;
+	mutable std::vector<char> onDisk;
+	mutable std::vector<unsigned> version;
+	bool stopping = false;
+	std::thread worker;
+
+	int chunkId(int x, int y, int z) const
+	{
+		return ((x >> CHUNK_LOG2) * chunksY + (y >> CHUNK_LOG2)) * chunksZ + (z >> CHUNK_LOG2);
+	}
+
+	void chunkCoords(int id, int& cx, int& cy, int& cz) const
+	{
+		cz = id % chunksZ;
+		cy = (id / chunksZ) % chunksY;
+		cx = id / (chunksZ * chunksY);
+	}
+
+	static int cellIndex(int x, int y, int z)
+	{
+		return ((x & (CHUNK_DIM - 1)) << (2 * CHUNK_LOG2)) | ((y & (CHUNK_DIM - 1)) << CHUNK_LOG2) | (z & (CHUNK_DIM - 1));
+	}
+
+	std::streamoff fileOffset(int id) const
+	{
+		return (std::streamoff)id * CHUNK_CELLS * sizeof(voxelPosition);
+	}
+
+	void activeChunks(std::vector<int>& active) const
+	{
+		active.clear();
+		for (int id = 0; id < (int)chunkVoxelCount.size(); id++)
+			if (chunkVoxelCount[id] > 0)
+				active.push_back(id);
+	}
+
+	Chunk* acquire(int id) const
+	{
+		if (id == cachedId)
+			return cachedChunk;
+
+		auto it = resident.find(id);
+		Chunk* chunk;
+		if (it != resident.end())
+		{
+			chunk = it->second.get();
+			lru.splice(lru.begin(), lru, chunk->lruPosition);
+		}
+		else
+		{
+			chunk = pageIn(id);
+		}
+		cachedId = id;
+		cachedChunk = chunk;
+		return chunk;
+	}
+
+	Chunk* pageIn(int id) const
+	{
+		while (resident.size() >= maxResident)
+			pageOut(lru.back());
+
+		std::unique_ptr<Chunk> chunk(new Chunk());
+		bool needsRead = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto prefetched = ready.find(id);
+			if (prefetched != ready.end())
+			{
+				chunk->cells = std::move(prefetched->second);
+				ready.erase(prefetched);
+				pagingStats.prefetchHits++;
+				pagingStats.pageIns++;
+			}
+			else if (chunkVoxelCount[id] > 0 && onDisk[id])
+			{
+				needsRead = true;
+			}
+		}
+
+		if (needsRead)
+		{
+			auto start = std::chrono::steady_clock::now();
+			chunk->cells.resize(CHUNK_CELLS);
+			file.clear();
+			file.seekg(fileOffset(id));
+			file.read(reinterpret_cast<char*>(chunk->cells.data()), CHUNK_CELLS * sizeof(voxelPosition));
+			pagingStats.stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			pagingStats.pageIns++;
+		}
+		else if (chunk->cells.empty())
+		{
+			chunk->cells.resize(CHUNK_CELLS);
+		}
+
+		lru.push_front(id);
+		chunk->lruPosition = lru.begin();
+		Chunk* result = chunk.get();
+		resident[id] = std::move(chunk);
+		return result;
+	}
+
+	void pageOut(int id) const
+	{
+		auto it = resident.find(id);
+		Chunk* chunk = it->second.get();
+
+		if (chunk->dirty)
+		{
+			if (chunkVoxelCount[id] == 0)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				version[id] += 2;
+				onDisk[id] = 0;
+				ready.erase(id);
+			}
+			else
+			{
+				auto start = std::chrono::steady_clock::now();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					version[id]++;
+					ready.erase(id);
+				}
+				file.clear();
+				file.seekp(fileOffset(id));
+				file.write(reinterpret_cast<const char*>(chunk->cells.data()), CHUNK_CELLS * sizeof(voxelPosition));
+				file.flush();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					version[id]++;
+					onDisk[id] = 1;
+				}
+				pagingStats.stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				pagingStats.pageOuts++;
+			}
+		}
+
+		if (cachedId == id)
+		{
+			cachedId = -1;
+			cachedChunk = nullptr;
+		}
+		lru.erase(chunk->lruPosition);
+		resident.erase(it);
+	}
+
+	void prefetch(int id) const
+	{
+		if (id < 0 || id >= (int)chunkVoxelCount.size() || chunkVoxelCount[id] == 0 || resident.count(id))
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!onDisk[id] || ready.count(id))
+				return;
+			prefetchQueue.push_back(id);
+		}
+		pagingStats.prefetchesIssued++;
+		wake.notify_one();
+	}
+
+	void prefetchAround(int id) const
+	{
+		int cx, cy, cz;
+		chunkCoords(id, cx, cy, cz);
+		prefetch(id);
+		if (cx > 0) prefetch(id - chunksY * chunksZ);
+		if (cx < chunksX - 1) prefetch(id + chunksY * chunksZ);
+		if (cy > 0) prefetch(id - chunksZ);
+		if (cy < chunksY - 1) prefetch(id + chunksZ);
+		if (cz > 0) prefetch(id - 1);
+		if (cz < chunksZ - 1) prefetch(id + 1);
+	}
+
+	//Reads queued chunks with its own file handle. A read is dropped if the chunk was written while it ran.
+	void prefetchLoop()
+	{
+		std::ifstream in(path, std::ios::binary);
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			wake.wait(lock, [this] { return stopping || !prefetchQueue.empty(); });
+			if (stopping)
+				return;
+
+			int id = prefetchQueue.front();
+			prefetchQueue.pop_front();
+			unsigned startVersion = version[id];
+			if (!onDisk[id] || (startVersion & 1) || ready.count(id))
+				continue;
+
+			lock.unlock();
+			std::vector<voxelPosition> cells(CHUNK_CELLS);
+			in.clear();
+			in.seekg(fileOffset(id));
+			in.read(reinterpret_cast<char*>(cells.data()), CHUNK_CELLS * sizeof(voxelPosition));
+			bool readOk = (bool)in;
+			lock.lock();
+
+			if (readOk && version[id] == startVersion)
+				ready[id] = std::move(cells);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <algorithm>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+//Hardware counters around a stretch of code, read through Linux perf_event_open: cycles, instructions, L1 data read
+//misses, last level cache misses, branches and branch misses. They count user mode on the calling thread only, so wrap
+//phases that run on one thread. Counters the CPU, kernel or VM doesn't offer are left out, and when none can be opened
+//(another OS, perf_event_paranoid above 2, no PMU in the VM) available() is false and everything else does nothing.
+//
+//  PerfCounters counters;
+//  counterTotals step;
+//  counters.start(); updateVoxelMatrixRandom(grid); counters.stop(step);
+//  std::cout << describeCounters(step, steps);
+
+struct counterTotals
+{
+	enum { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCHES, BRANCH_MISSES, COUNTER_COUNT };
+
+	uint64_t values[COUNTER_COUNT] = {};
+	bool present[COUNTER_COUNT] = {};
+};
+
+class PerfCounters
+{
+public:
+	PerfCounters()
+	{
+		for (int c = 0; c < counterTotals::COUNTER_COUNT; c++)
+			fds[c] = -1;
+#if defined(__linux__)
+		const uint32_t l1dReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		const uint32_t types[counterTotals::COUNTER_COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+			PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+		const uint64_t configs[counterTotals::COUNTER_COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, l1dReadMiss,
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES };
+
+		//One group led by cycles, so all counters are scheduled onto the PMU together
+		for (int c = 0; c < counterTotals::COUNTER_COUNT; c++)
+		{
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = types[c];
+			attr.config = configs[c];
+			attr.disabled = leader < 0 ? 1 : 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+			if (fd < 0)
+			{
+				//Without cycles there is no group to join
+				if (c == counterTotals::CYCLES)
+					return;
+				continue;
+			}
+			if (leader < 0)
+				leader = fd;
+			fds[c] = fd;
+			ioctl(fd, PERF_EVENT_IOC_ID, &ids[c]);
+		}
+#endif
+	}
+
+	~PerfCounters()
+	{
+#if defined(__linux__)
+		for (int c = 0; c < counterTotals::COUNTER_COUNT; c++)
+			if (fds[c] >= 0)
+				close(fds[c]);
+#endif
+	}
+
+	bool available() const { return leader >= 0; }
+
+	void start()
+	{
+#if defined(__linux__)
+		if (leader < 0)
+			return;
+		ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	}
+
+	//Adds the counts since start() to totals, scaled up if the kernel had to multiplex the group with other events
+	void stop(counterTotals& totals)
+	{
+#if defined(__linux__)
+		if (leader < 0)
+			return;
+		ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+		//nr, time enabled, time running, then a value and id per counter
+		uint64_t buffer[3 + 2 * counterTotals::COUNTER_COUNT];
+		if (read(leader, buffer, sizeof(buffer)) < (ssize_t)(3 * sizeof(uint64_t)))
+			return;
+		double scale = buffer[2] > 0 ? (double)buffer[1] / buffer[2] : 1.0;
+		for (uint64_t n = 0; n < buffer[0] && n < (uint64_t)counterTotals::COUNTER_COUNT; n++)
+		{
+			uint64_t value = buffer[3 + 2 * n];
+			uint64_t id = buffer[4 + 2 * n];
+			for (int c = 0; c < counterTotals::COUNTER_COUNT; c++)
+			{
+				if (fds[c] >= 0 && ids[c] == id)
+				{
+					totals.values[c] += (uint64_t)(value * scale);
+					totals.present[c] = true;
+				}
+			}
+		}
+#else
+		(void)totals;
+#endif
+	}
+
+private:
+	int leader = -1;
+	int fds[counterTotals::COUNTER_COUNT];
+	uint64_t ids[counterTotals::COUNTER_COUNT] = {};
+};
+
+//One line of per-step counts and rates: cycles and instructions per step, IPC, L1D and LLC misses per thousand
+//instructions and the share of branches mispredicted. Empty when nothing was counted.
+inline std::string describeCounters(const counterTotals& totals, long long steps)
+{
+	const uint64_t* v = totals.values;
+	const bool* has = totals.present;
+	if (!has[counterTotals::CYCLES] || steps <= 0)
+		return "";
+
+	std::string line;
+	char part[96];
+	snprintf(part, sizeof(part), "%.3g cycles/step", (double)v[counterTotals::CYCLES] / steps);
+	line += part;
+	if (has[counterTotals::INSTRUCTIONS] && v[counterTotals::INSTRUCTIONS] > 0)
+	{
+		double kiloInstructions = v[counterTotals::INSTRUCTIONS] / 1000.0;
+		snprintf(part, sizeof(part), ", %.3g instructions/step, IPC %.2f", (double)v[counterTotals::INSTRUCTIONS] / steps,
+			(double)v[counterTotals::INSTRUCTIONS] / std::max<uint64_t>(1, v[counterTotals::CYCLES]));
+		line += part;
+		if (has[counterTotals::L1D_MISSES])
+		{
+			snprintf(part, sizeof(part), ", %.2f L1D misses/kinstr", v[counterTotals::L1D_MISSES] / kiloInstructions);
+			line += part;
+		}
+		if (has[counterTotals::LLC_MISSES])
+		{
+			snprintf(part, sizeof(part), ", %.2f LLC misses/kinstr", v[counterTotals::LLC_MISSES] / kiloInstructions);
+			line += part;
+		}
+	}
+	if (has[counterTotals::BRANCHES] && has[counterTotals::BRANCH_MISSES] && v[counterTotals::BRANCHES] > 0)
+	{
+		snprintf(part, sizeof(part), ", %.2f%% branches mispredicted", 100.0 * v[counterTotals::BRANCH_MISSES] / v[counterTotals::BRANCHES]);
+		line += part;
+	}
+	return line;
+}
+
+#endif
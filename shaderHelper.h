@@ -2,22 +2,145 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <sys/stat.h>
 
 //This header allows easy compilation and creation of a shader program with a vertex and fragment shader
 //It is essentially identical to the one on https://learnopengl.com/Getting-started/Shaders
+//On top of that it caches linked program binaries keyed by a hash of the sources and the driver strings, so later
+//launches skip compilation, and can watch its source files and relink when they change. Uniform locations are cached
+//per program and uniform block bindings are remembered, so both survive a relink.
 
 class ShaderHelper
 {
 public:
     unsigned int ID;
+    // how the program was built the last time, for startup reporting
+    bool loadedFromCache = false;
+    double buildMilliseconds = 0;
+    // compile/link log of the last failed build, empty if it succeeded
+    std::string errorLog;
+
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
-    ShaderHelper(const char* vertexPath, const char* fragmentPath)
+    ShaderHelper(const char* vertexPath, const char* fragmentPath, bool watchSources = false, bool useBinaryCache = true)
+        : vertexFile(vertexPath), fragmentFile(fragmentPath), watching(watchSources), useCache(useBinaryCache)
+    {
+        vertexTime = modificationTime(vertexFile);
+        fragmentTime = modificationTime(fragmentFile);
+        ID = build();
+    }
+    // activate the shader
+    // ------------------------------------------------------------------------
+    void use()
+    {
+        glUseProgram(ID);
+    }
+    // relinks the program if either source file changed since the last build. On failure the old program is kept.
+    // returns true when ID changed, so the caller can reapply uniforms
+    // ------------------------------------------------------------------------
+    bool reloadIfChanged()
+    {
+        if (!watching)
+            return false;
+        std::time_t newVertexTime = modificationTime(vertexFile);
+        std::time_t newFragmentTime = modificationTime(fragmentFile);
+        if (newVertexTime == vertexTime && newFragmentTime == fragmentTime)
+            return false;
+        vertexTime = newVertexTime;
+        fragmentTime = newFragmentTime;
+
+        unsigned int program = build();
+        if (program == 0)
+            return false;
+        glDeleteProgram(ID);
+        ID = program;
+        uniformLocations.clear();
+        for (const auto& block : blockBindings)
+            applyBlockBinding(block.first, block.second);
+        std::cout << "Reloaded shader program from " << vertexFile << " and " << fragmentFile << std::endl;
+        return true;
+    }
+    // connects a uniform block to a buffer binding point; remembered so a relinked program is connected again
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const std::string& name, unsigned int binding)
+    {
+        blockBindings[name] = binding;
+        applyBlockBinding(name, binding);
+    }
+    // location of a uniform, queried from the driver only the first time it is asked for
+    // ------------------------------------------------------------------------
+    int uniformLocation(const std::string& name) const
+    {
+        auto found = uniformLocations.find(name);
+        if (found != uniformLocations.end())
+            return found->second;
+        int location = glGetUniformLocation(ID, name.c_str());
+        uniformLocations[name] = location;
+        return location;
+    }
+    // utility uniform functions
+    // ------------------------------------------------------------------------
+    void setBool(const std::string& name, bool value) const
+    {
+        glUniform1i(uniformLocation(name), (int)value);
+    }
+    // ------------------------------------------------------------------------
+    void setInt(const std::string& name, int value) const
+    {
+        glUniform1i(uniformLocation(name), value);
+    }
+    // ------------------------------------------------------------------------
+    void setFloat(const std::string& name, float value) const
+    {
+        glUniform1f(uniformLocation(name), value);
+    }
+    // ------------------------------------------------------------------------
+    void setMat4(const std::string& name, const glm::mat4& mat) const
+    {
+        glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+    }
+
+private:
+    std::string vertexFile;
+    std::string fragmentFile;
+    bool watching;
+    bool useCache;
+    std::time_t vertexTime = 0;
+    std::time_t fragmentTime = 0;
+    mutable std::unordered_map<std::string, int> uniformLocations;
+    std::unordered_map<std::string, unsigned int> blockBindings;
+
+    static std::time_t modificationTime(const std::string& path)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return 0;
+        return info.st_mtime;
+    }
+    void applyBlockBinding(const std::string& name, unsigned int binding)
+    {
+        unsigned int index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
+    // reads, compiles and links both stages, going through the binary cache. Returns 0 on failure.
+    // ------------------------------------------------------------------------
+    unsigned int build()
     {
+        auto start = std::chrono::steady_clock::now();
+        errorLog.clear();
+        loadedFromCache = false;
+
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -29,8 +152,8 @@ public:
         try
         {
             // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
+            vShaderFile.open(vertexFile);
+            fShaderFile.open(fragmentFile);
             std::stringstream vShaderStream, fShaderStream;
             // read file's buffer contents into streams
             vShaderStream << vShaderFile.rdbuf();
@@ -46,57 +169,136 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
+
+        // 2. try the program binary cache
+        std::string cachePath = cacheFileName(vertexCode, fragmentCode);
+        unsigned int program = 0;
+        if (useCache)
+            program = loadCachedBinary(cachePath);
+        if (program != 0)
+        {
+            loadedFromCache = true;
+        }
+        else
+        {
+            program = compileAndLink(vertexCode.c_str(), fragmentCode.c_str());
+            if (program != 0 && useCache)
+                saveCachedBinary(program, cachePath);
+        }
+
+        buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return program;
+    }
+    // ------------------------------------------------------------------------
+    unsigned int compileAndLink(const char* vShaderCode, const char* fShaderCode)
+    {
+        // compile shaders
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+        bool vertexOk = checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        bool fragmentOk = checkCompileErrors(fragment, "FRAGMENT");
         // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+        unsigned int program = glCreateProgram();
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        glLinkProgram(program);
+        bool programOk = checkCompileErrors(program, "PROGRAM");
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+
+        if (!vertexOk || !fragmentOk || !programOk)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
     }
-    // activate the shader
-    // ------------------------------------------------------------------------
-    void use()
-    {
-        glUseProgram(ID);
-    }
-    // utility uniform functions
+    // cache key: FNV-1a over both sources plus the vendor, renderer and version strings, since binaries are driver specific
     // ------------------------------------------------------------------------
-    void setBool(const std::string& name, bool value) const
+    static std::string cacheFileName(const std::string& vertexCode, const std::string& fragmentCode)
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const std::string& text)
+        {
+            for (unsigned char c : text)
+            {
+                hash ^= c;
+                hash *= 1099511628211ull;
+            }
+            hash ^= 0xff;
+            hash *= 1099511628211ull;
+        };
+        mix(vertexCode);
+        mix(fragmentCode);
+        const char* strings[3] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+        for (const char* driverString : strings)
+            mix(driverString ? driverString : "");
+
+        std::stringstream name;
+        name << "shaderCache_" << std::hex << hash << ".bin";
+        return name.str();
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string& name, int value) const
+    static unsigned int loadCachedBinary(const std::string& path)
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        int formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        if (formatCount == 0)
+            return 0;
+
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return 0;
+        std::streamoff size = (std::streamoff)file.tellg() - (std::streamoff)sizeof(GLenum);
+        if (size <= 0)
+            return 0;
+        file.seekg(0);
+        GLenum format = 0;
+        std::vector<char> binary((size_t)size);
+        file.read(reinterpret_cast<char*>(&format), sizeof(format));
+        file.read(binary.data(), size);
+        if (!file)
+            return 0;
+
+        unsigned int program = glCreateProgram();
+        glProgramBinary(program, format, binary.data(), (GLsizei)binary.size());
+        int success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // stale or rejected by the driver; rebuilding from source overwrites it
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string& name, float value) const
+    static void saveCachedBinary(unsigned int program, const std::string& path)
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-    }
+        int length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
 
-private:
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, NULL, &format, binary.data());
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(binary.data(), length);
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(unsigned int shader, std::string type)
+    bool checkCompileErrors(unsigned int shader, std::string type)
     {
         int success;
         char infoLog[1024];
@@ -107,6 +309,7 @@ private:
             {
                 glGetShaderInfoLog(shader, 1024, NULL, infoLog);
                 std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                errorLog += type + ": " + infoLog + "\n";
             }
         }
         else
@@ -116,8 +319,10 @@ private:
             {
                 glGetProgramInfoLog(shader, 1024, NULL, infoLog);
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                errorLog += type + ": " + infoLog + "\n";
             }
         }
+        return success != 0;
     }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,137 @@
+#ifndef SIMULATION_ENSEMBLE_H
+#define SIMULATION_ENSEMBLE_H
+
+#include "voxelGrid.h"
+#include "jobSystem.h"
+#include <vector>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+//Many small independent simulations stepped together, for parameter studies whose grids are each too small to keep
+//the cores busy. Every member has its own grid, seed, fill fraction and random generator, and run() gives each member
+//to one job that takes all of its steps, so a member stays in one worker's cache and members never synchronise with
+//each other. Work stealing spreads the members over the workers. A member's result depends only on its seed and fill,
+//not on the worker count or the order the members ran in.
+//
+//Members start with the lower half of the grid filled at random, each cell with probability equal to the member's fill
+//fraction; fractions are spread evenly over [minFill, maxFill] across the members.
+
+struct ensembleMemberStats
+{
+	long long voxels = 0;
+	double meanHeight = 0;
+	//Standard deviation of voxel heights, how far the fluid is from a flat layer
+	double heightSpread = 0;
+	int topHeight = -1;
+	long long occupiedColumns = 0;
+	double stepMilliseconds = 0;
+};
+
+template <typename Grid>
+class SimulationEnsemble
+{
+public:
+	struct member
+	{
+		std::unique_ptr<Grid> grid;
+		std::mt19937 random;
+		unsigned seed;
+		float fill;
+		long long placed;
+		ensembleMemberStats stats;
+	};
+
+	SimulationEnsemble(int count, int size, unsigned firstSeed, float minFill, float maxFill) : members(count)
+	{
+		for (int m = 0; m < count; m++)
+		{
+			member& entry = members[m];
+			entry.seed = firstSeed + m;
+			entry.fill = memberFill(m, count, minFill, maxFill);
+			entry.random.seed(entry.seed);
+			entry.grid.reset(new Grid(size, size, size));
+			entry.placed = fill(*entry.grid, entry.random, entry.fill);
+		}
+	}
+
+	int size() const { return (int)members.size(); }
+
+	member& operator[](int m) { return members[m]; }
+	const member& operator[](int m) const { return members[m]; }
+
+	//Takes steps steps on every member with step(grid, random), one job per member, then summarises each member.
+	//Returns the wall clock seconds for the whole ensemble.
+	template <typename Step>
+	double run(JobSystem& jobs, int steps, Step step)
+	{
+		auto start = std::chrono::steady_clock::now();
+		jobs.parallelFor(0, size(), 1, [&](int begin, int end, int)
+		{
+			for (int m = begin; m < end; m++)
+			{
+				member& entry = members[m];
+				auto memberStart = std::chrono::steady_clock::now();
+				for (int s = 0; s < steps; s++)
+					step(*entry.grid, entry.random);
+				double memberMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - memberStart).count();
+
+				entry.stats = summarize(*entry.grid);
+				entry.stats.stepMilliseconds = steps > 0 ? memberMs / steps : 0;
+			}
+		});
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	static float memberFill(int m, int count, float minFill, float maxFill)
+	{
+		return count > 1 ? minFill + (maxFill - minFill) * m / (count - 1) : minFill;
+	}
+
+	static long long fill(Grid& grid, std::mt19937& random, float fraction)
+	{
+		uint32_t threshold = (uint32_t)(std::min(1.0, std::max(0.0, (double)fraction)) * 4294967295.0);
+		long long placed = 0;
+		for (int i = 0; i < grid.sizeX; i++)
+			for (int j = 0; j < grid.sizeY / 2; j++)
+				for (int k = 0; k < grid.sizeZ; k++)
+					if (random() < threshold)
+					{
+						grid.placeVoxel(i, j, k);
+						placed++;
+					}
+		return placed;
+	}
+
+	static ensembleMemberStats summarize(const Grid& grid)
+	{
+		ensembleMemberStats stats;
+		double heightSum = 0;
+		double heightSquares = 0;
+		std::vector<char> columns((size_t)grid.sizeX * grid.sizeZ, 0);
+		grid.forEachVoxel([&](int i, int j, int k, const voxelPosition&)
+		{
+			stats.voxels++;
+			heightSum += j;
+			heightSquares += (double)j * j;
+			stats.topHeight = std::max(stats.topHeight, j);
+			columns[(size_t)i * grid.sizeZ + k] = 1;
+		});
+		for (char column : columns)
+			stats.occupiedColumns += column;
+		if (stats.voxels > 0)
+		{
+			stats.meanHeight = heightSum / stats.voxels;
+			stats.heightSpread = std::sqrt(std::max(0.0, heightSquares / stats.voxels - stats.meanHeight * stats.meanHeight));
+		}
+		return stats;
+	}
+
+private:
+	std::vector<member> members;
+};
+
+#endif
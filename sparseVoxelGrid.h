@@ -0,0 +1,410 @@
+#ifndef SPARSE_VOXEL_GRID_H
+#define SPARSE_VOXEL_GRID_H
+
+#include "voxelGrid.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//A sparse hierarchical grid in the style of OpenVDB: a root hash map of internal nodes, each internal node
+//holding 16^3 leaf slots, each leaf holding 8^3 values plus an occupancy bitmask.
+//Memory scales with the number of touched 8^3 leaves instead of the bounding box of the domain.
+
+template <typename ValueT>
+class SparseVoxelGrid
+{
+public:
+	static const int LEAF_LOG2 = 3;
+	static const int LEAF_DIM = 1 << LEAF_LOG2;
+	static const int LEAF_SIZE = LEAF_DIM * LEAF_DIM * LEAF_DIM;
+	static const int INTERNAL_LOG2 = 4;
+	static const int INTERNAL_DIM = 1 << INTERNAL_LOG2;
+	static const int INTERNAL_SIZE = INTERNAL_DIM * INTERNAL_DIM * INTERNAL_DIM;
+	static const int INTERNAL_SPAN_LOG2 = LEAF_LOG2 + INTERNAL_LOG2;
+
+	struct LeafNode
+	{
+		int originX, originY, originZ;
+		int activeCount = 0;
+		uint64_t valueMask[LEAF_SIZE / 64] = {};
+		ValueT values[LEAF_SIZE];
+
+		LeafNode(int x, int y, int z) : originX(x), originY(y), originZ(z) {}
+
+		//z fastest, same order as the dense matrix
+		static int offset(int x, int y, int z)
+		{
+			return ((x & (LEAF_DIM - 1)) << (2 * LEAF_LOG2)) | ((y & (LEAF_DIM - 1)) << LEAF_LOG2) | (z & (LEAF_DIM - 1));
+		}
+
+		bool isOn(int n) const { return (valueMask[n >> 6] >> (n & 63)) & 1; }
+		void setOn(int n) { valueMask[n >> 6] |= (uint64_t)1 << (n & 63); }
+		void setOff(int n) { valueMask[n >> 6] &= ~((uint64_t)1 << (n & 63)); }
+	};
+
+	struct InternalNode
+	{
+		int originX, originY, originZ;
+		int childCount = 0;
+		std::unique_ptr<LeafNode> children[INTERNAL_SIZE];
+
+		InternalNode(int x, int y, int z) : originX(x), originY(y), originZ(z) {}
+
+		static int offset(int x, int y, int z)
+		{
+			const int mask = INTERNAL_DIM - 1;
+			return (((x >> LEAF_LOG2) & mask) << (2 * INTERNAL_LOG2)) | (((y >> LEAF_LOG2) & mask) << INTERNAL_LOG2) | ((z >> LEAF_LOG2) & mask);
+		}
+	};
+
+	//Caches the last visited internal node and leaf so runs of neighbouring lookups skip the root hash.
+	//Accessors are invalidated by prune() and clear(); call reset() afterwards.
+	class Accessor
+	{
+	public:
+		explicit Accessor(SparseVoxelGrid& _grid) : grid(&_grid) {}
+
+		void reset()
+		{
+			leaf = nullptr;
+			internal = nullptr;
+		}
+
+		LeafNode* probeLeaf(int x, int y, int z)
+		{
+			if (leaf && (x & ~(LEAF_DIM - 1)) == leaf->originX && (y & ~(LEAF_DIM - 1)) == leaf->originY && (z & ~(LEAF_DIM - 1)) == leaf->originZ)
+				return leaf;
+
+			InternalNode* node = probeInternal(x, y, z);
+			if (!node)
+				return nullptr;
+
+			LeafNode* found = node->children[InternalNode::offset(x, y, z)].get();
+			if (found)
+				leaf = found;
+			return found;
+		}
+
+		LeafNode* touchLeaf(int x, int y, int z)
+		{
+			LeafNode* found = probeLeaf(x, y, z);
+			if (found)
+				return found;
+
+			InternalNode* node = probeInternal(x, y, z);
+			if (!node)
+			{
+				node = grid->createInternal(x, y, z);
+				internal = node;
+			}
+
+			std::unique_ptr<LeafNode>& slot = node->children[InternalNode::offset(x, y, z)];
+			slot = grid->newLeaf(x & ~(LEAF_DIM - 1), y & ~(LEAF_DIM - 1), z & ~(LEAF_DIM - 1));
+			node->childCount++;
+			grid->leafCount++;
+			leaf = slot.get();
+			return leaf;
+		}
+
+		bool isOn(int x, int y, int z)
+		{
+			LeafNode* node = probeLeaf(x, y, z);
+			return node && node->isOn(LeafNode::offset(x, y, z));
+		}
+
+		//Returns null when the voxel is off
+		ValueT* probeValue(int x, int y, int z)
+		{
+			LeafNode* node = probeLeaf(x, y, z);
+			if (!node)
+				return nullptr;
+			int n = LeafNode::offset(x, y, z);
+			return node->isOn(n) ? &node->values[n] : nullptr;
+		}
+
+		void setValueOn(int x, int y, int z, const ValueT& value)
+		{
+			LeafNode* node = touchLeaf(x, y, z);
+			int n = LeafNode::offset(x, y, z);
+			if (!node->isOn(n))
+			{
+				node->setOn(n);
+				node->activeCount++;
+				grid->activeCount++;
+			}
+			node->values[n] = value;
+		}
+
+		void setValueOff(int x, int y, int z)
+		{
+			LeafNode* node = probeLeaf(x, y, z);
+			if (!node)
+				return;
+			int n = LeafNode::offset(x, y, z);
+			if (node->isOn(n))
+			{
+				node->setOff(n);
+				node->values[n] = ValueT();
+				node->activeCount--;
+				grid->activeCount--;
+			}
+		}
+
+	private:
+		SparseVoxelGrid* grid;
+		InternalNode* internal = nullptr;
+		LeafNode* leaf = nullptr;
+
+		InternalNode* probeInternal(int x, int y, int z)
+		{
+			const int spanMask = ~((1 << INTERNAL_SPAN_LOG2) - 1);
+			if (internal && (x & spanMask) == internal->originX && (y & spanMask) == internal->originY && (z & spanMask) == internal->originZ)
+				return internal;
+
+			auto it = grid->root.find(rootKey(x, y, z));
+			if (it == grid->root.end())
+				return nullptr;
+			internal = it->second.get();
+			return internal;
+		}
+	};
+
+	size_t activeVoxelCount() const { return activeCount; }
+	size_t leafNodeCount() const { return leafCount; }
+	size_t internalNodeCount() const { return root.size(); }
+
+	size_t memoryBytes() const
+	{
+		return (leafCount + spareLeaves.size()) * sizeof(LeafNode) + root.size() * (sizeof(InternalNode) + sizeof(typename RootMap::value_type) + sizeof(void*));
+	}
+
+	//Visits leaves sorted by origin so sweeps are reproducible regardless of hash order.
+	//Leaves created by f are not visited; no leaf is freed until prune().
+	template <typename F>
+	void forEachLeafSorted(F f)
+	{
+		//Kept between sweeps so the list doesn't allocate every step
+		std::vector<LeafNode*>& leaves = sortedLeaves;
+		leaves.clear();
+		collectLeaves(leaves);
+		std::sort(leaves.begin(), leaves.end(), [](const LeafNode* a, const LeafNode* b)
+		{
+			if (a->originX != b->originX) return a->originX < b->originX;
+			if (a->originY != b->originY) return a->originY < b->originY;
+			return a->originZ < b->originZ;
+		});
+		for (LeafNode* node : leaves)
+			f(*node);
+	}
+
+	//Calls f(x, y, z, value) for every active voxel, in no particular order
+	template <typename F>
+	void forEachOn(F f) const
+	{
+		for (const auto& entry : root)
+		{
+			const InternalNode& node = *entry.second;
+			if (node.childCount == 0)
+				continue;
+			for (int c = 0; c < INTERNAL_SIZE; c++)
+			{
+				const LeafNode* child = node.children[c].get();
+				if (!child || child->activeCount == 0)
+					continue;
+				for (int w = 0; w < LEAF_SIZE / 64; w++)
+				{
+					uint64_t bits = child->valueMask[w];
+					while (bits)
+					{
+						int n = w * 64 + countTrailingZeros(bits);
+						bits &= bits - 1;
+						f(child->originX + (n >> (2 * LEAF_LOG2)), child->originY + ((n >> LEAF_LOG2) & (LEAF_DIM - 1)), child->originZ + (n & (LEAF_DIM - 1)), child->values[n]);
+					}
+				}
+			}
+		}
+	}
+
+	//Frees empty leaves and internal nodes. Invalidates accessors. Up to SPARE_LEAVES empty leaves are kept for reuse, so
+	//sand moving back and forth across a leaf boundary doesn't free and allocate a leaf every step.
+	void prune()
+	{
+		for (auto it = root.begin(); it != root.end();)
+		{
+			InternalNode& node = *it->second;
+			for (int c = 0; c < INTERNAL_SIZE && node.childCount > 0; c++)
+			{
+				if (node.children[c] && node.children[c]->activeCount == 0)
+				{
+					if (spareLeaves.size() < SPARE_LEAVES)
+						spareLeaves.push_back(std::move(node.children[c]));
+					node.children[c].reset();
+					node.childCount--;
+					leafCount--;
+				}
+			}
+			if (node.childCount == 0)
+				it = root.erase(it);
+			else
+				++it;
+		}
+	}
+
+	void clear()
+	{
+		root.clear();
+		spareLeaves.clear();
+		leafCount = 0;
+		activeCount = 0;
+	}
+
+	static int countTrailingZeros(uint64_t bits)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return (int)index;
+#else
+		return __builtin_ctzll(bits);
+#endif
+	}
+
+private:
+	typedef std::unordered_map<uint64_t, std::unique_ptr<InternalNode>> RootMap;
+	enum { SPARE_LEAVES = 64 };
+	RootMap root;
+	size_t leafCount = 0;
+	size_t activeCount = 0;
+	std::vector<std::unique_ptr<LeafNode>> spareLeaves;
+	std::vector<LeafNode*> sortedLeaves;
+
+	//A spare leaf if there is one, otherwise a new one
+	std::unique_ptr<LeafNode> newLeaf(int x, int y, int z)
+	{
+		if (spareLeaves.empty())
+			return std::unique_ptr<LeafNode>(new LeafNode(x, y, z));
+		std::unique_ptr<LeafNode> leaf = std::move(spareLeaves.back());
+		spareLeaves.pop_back();
+		//The leaf is empty, and setValueOff() already reset the values of its voxels
+		leaf->originX = x;
+		leaf->originY = y;
+		leaf->originZ = z;
+		leaf->activeCount = 0;
+		std::fill(leaf->valueMask, leaf->valueMask + LEAF_SIZE / 64, 0);
+		return leaf;
+	}
+
+	//21 bits per axis of the internal node coordinate, enough for +-2^27 voxels
+	static uint64_t rootKey(int x, int y, int z)
+	{
+		const uint64_t mask = (1u << 21) - 1;
+		return (((uint64_t)(x >> INTERNAL_SPAN_LOG2) & mask) << 42) | (((uint64_t)(y >> INTERNAL_SPAN_LOG2) & mask) << 21) | ((uint64_t)(z >> INTERNAL_SPAN_LOG2) & mask);
+	}
+
+	InternalNode* createInternal(int x, int y, int z)
+	{
+		const int spanMask = ~((1 << INTERNAL_SPAN_LOG2) - 1);
+		std::unique_ptr<InternalNode>& slot = root[rootKey(x, y, z)];
+		slot.reset(new InternalNode(x & spanMask, y & spanMask, z & spanMask));
+		return slot.get();
+	}
+
+	void collectLeaves(std::vector<LeafNode*>& leaves)
+	{
+		for (auto& entry : root)
+		{
+			InternalNode& node = *entry.second;
+			for (int c = 0; c < INTERNAL_SIZE && node.childCount > 0; c++)
+				if (node.children[c])
+					leaves.push_back(node.children[c].get());
+		}
+	}
+};
+
+//Adapts the sparse tree to the common grid interface in voxelGrid.h, with bounds matching the dense matrix.
+class SparseVoxelMatrix
+{
+public:
+	typedef SparseVoxelGrid<voxelPosition> Tree;
+
+	const int sizeX;
+	const int sizeY;
+	const int sizeZ;
+
+	SparseVoxelMatrix(int x, int y, int z) : sizeX(x), sizeY(y), sizeZ(z), accessor(tree) {}
+
+	bool containsVoxel(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return false;
+		return accessor.isOn(x, y, z);
+	}
+
+	//The cell must contain a voxel
+	voxelPosition& at(int x, int y, int z)
+	{
+		return *accessor.probeValue(x, y, z);
+	}
+
+	uint8_t materialAt(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return MATERIAL_EMPTY;
+		const voxelPosition* cell = accessor.probeValue(x, y, z);
+		return cell ? cell->material : (uint8_t)MATERIAL_EMPTY;
+	}
+
+	void placeVoxel(int x, int y, int z, glm::vec3 velocity = glm::vec3(0.0f), uint8_t material = MATERIAL_WATER)
+	{
+		voxelPosition cell;
+		cell.containsVoxel = true;
+		cell.material = material;
+		cell.velocity = velocity;
+		accessor.setValueOn(x, y, z, cell);
+	}
+
+	void removeVoxel(int x, int y, int z)
+	{
+		accessor.setValueOff(x, y, z);
+	}
+
+	//Walks occupied leaves in sorted order, then frees the leaves the sweep emptied
+	template <typename F>
+	void sweep(F f)
+	{
+		tree.forEachLeafSorted([&](Tree::LeafNode& leaf)
+		{
+			for (int n = 0; n < Tree::LEAF_SIZE; n++)
+			{
+				if (leaf.isOn(n))
+					f(leaf.originX + (n >> (2 * Tree::LEAF_LOG2)), leaf.originY + ((n >> Tree::LEAF_LOG2) & (Tree::LEAF_DIM - 1)), leaf.originZ + (n & (Tree::LEAF_DIM - 1)));
+			}
+		});
+		tree.prune();
+		accessor.reset();
+	}
+
+	template <typename F>
+	void forEachVoxel(F f) const
+	{
+		tree.forEachOn(f);
+	}
+
+	size_t memoryBytes() const
+	{
+		return tree.memoryBytes();
+	}
+
+	Tree tree;
+
+private:
+	//Caches the last leaf visited, so const lookups still update it
+	mutable Tree::Accessor accessor;
+};
+
+#endif
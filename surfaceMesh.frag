@@ -0,0 +1,14 @@
+#version 460 core
+
+in vec3 normal;
+out vec4 FragColor;
+
+const vec3 lightDirection = normalize(vec3(0.4, 1.0, 0.25));
+const vec3 fluidColour = vec3(0.25, 0.55, 0.9);
+
+void main()
+{
+	//Normals are interpolated between welded vertices, so the surface shades smoothly
+	float diffuse = max(dot(normalize(normal), lightDirection), 0.0);
+	FragColor = vec4(fluidColour * (0.3 + 0.7 * diffuse), 1.0);
+}
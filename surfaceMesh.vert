@@ -0,0 +1,26 @@
+#version 460 core
+
+//Vertices of the surface net built by SurfaceMesher, see surfaceMesher.h
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+out vec3 normal;
+
+uniform mat4 modelToWorld;
+
+//Per-frame state, see frameUniforms.h
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+    mat4 inverseViewProjection;
+};
+
+void main()
+{
+	normal = mat3(modelToWorld) * aNormal;
+    gl_Position = viewProjection * modelToWorld * vec4(aPos, 1.0);
+}
@@ -0,0 +1,397 @@
+#ifndef SURFACE_MESHER_H
+#define SURFACE_MESHER_H
+
+#include "voxelGrid.h"
+#include "jobSystem.h"
+#include "frameArena.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+//Extracts a smooth surface from the occupancy grid with surface nets, the dual of marching cubes: one vertex per cube of
+//8 neighbouring cell centres that the surface passes through, placed at the mean of its edge crossings, and one quad per
+//cell-centre edge that crosses the surface, joining the vertices of the 4 cubes around that edge. Because each cube has
+//exactly one vertex that every quad around it reuses, the mesh comes out welded without a lookup table.
+//
+//The density sampled at cell centres is occupancy blurred with a [1 4 1] / 6 kernel along each axis, and the surface is
+//where it equals isoLevel. isoLevel must stay above 1/6, so the density one cell outside the grid is always below it and
+//the surface closes at the walls; the default of 0.25 keeps single voxels as small blobs.
+//
+//Cubes are grouped into CHUNK^3 chunks that are meshed as separate jobs and kept between updates. update() compares the
+//new occupancy with the previous one and only remeshes chunks near a changed cell, then a job that depends on all of
+//them concatenates the chunk meshes into one indexed mesh. Quads on a seam use vertices of cubes in the chunks below,
+//which only those chunks store; the gather looks them up there, so every cube still has one vertex and the mesh stays
+//welded across chunks.
+
+struct surfaceVertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+};
+
+class SurfaceMesher
+{
+public:
+	enum { CHUNK = 16 };
+
+	//Milliseconds the last update() took, and how many chunks it remeshed
+	double lastUpdateMilliseconds = 0;
+	int lastRemeshedChunks = 0;
+
+	SurfaceMesher(int x, int y, int z, float spacing, JobSystem& jobs, float isoLevel = 0.25f)
+		: voxelSpacing(spacing), isoLevel(isoLevel), jobs(jobs), scratch(jobs)
+	{
+		size[0] = x;
+		size[1] = y;
+		size[2] = z;
+		//Cubes run from -1 to size - 1 on each axis, so the surface can close one cell outside the grid
+		for (int axis = 0; axis < 3; axis++)
+			chunkCount[axis] = (size[axis] + 1 + CHUNK - 1) / CHUNK;
+		chunks.resize((size_t)chunkCount[0] * chunkCount[1] * chunkCount[2]);
+
+		//Two cells of zero padding on every side so the blur never reads outside
+		occupancy.assign((size_t)(x + 4) * (y + 4) * (z + 4), 0);
+		previousOccupancy = occupancy;
+	}
+
+	//The dirty chunk list and job handles are taken from arena
+	template <typename Grid>
+	void update(const Grid& grid, FrameArena& arena)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		std::swap(occupancy, previousOccupancy);
+		std::fill(occupancy.begin(), occupancy.end(), 0);
+		grid.forEachVoxel([&](int x, int y, int z, const voxelPosition&)
+		{
+			occupancy[occupancyIndex(x, y, z)] = 1;
+		});
+		markChangedChunks();
+
+		arenaVector<int> dirty{ ArenaAllocator<int>(arena) };
+		for (int i = 0; i < (int)chunks.size(); i++)
+		{
+			if (chunks[i].dirty)
+				dirty.push_back(i);
+		}
+
+		if (!dirty.empty())
+		{
+			arenaVector<JobSystem::JobHandle> meshing{ ArenaAllocator<JobSystem::JobHandle>(arena) };
+			meshing.reserve(dirty.size());
+			for (int chunk : dirty)
+				meshing.push_back(jobs.submit([this, chunk](int worker) { meshChunk(chunk, scratch[worker]); }));
+			jobs.wait(jobs.submit([this](int) { gatherChunks(); }, meshing));
+		}
+
+		lastRemeshedChunks = (int)dirty.size();
+		lastUpdateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	const std::vector<surfaceVertex>& vertices() const { return meshVertices; }
+	const std::vector<uint32_t>& indices() const { return meshIndices; }
+	size_t triangleCount() const { return meshIndices.size() / 3; }
+	int totalChunks() const { return (int)chunks.size(); }
+
+private:
+	//Set in a chunk's indices for vertices it takes from the chunks below; the rest of the index is into border
+	static const uint32_t BORDER_VERTEX = 0x80000000u;
+
+	struct seamVertex
+	{
+		uint32_t cube;
+		uint32_t vertex;
+	};
+
+	struct borderVertex
+	{
+		uint32_t chunk;
+		uint32_t cube;
+	};
+
+	struct surfaceChunk
+	{
+		//Vertices of the cubes the chunk owns
+		std::vector<surfaceVertex> vertices;
+		std::vector<uint32_t> indices;
+		//Owned cubes on the chunk's high faces, which the chunks above reach into, in cube order
+		std::vector<seamVertex> seam;
+		//Cubes of the chunks below that the chunk's quads use
+		std::vector<borderVertex> border;
+		bool dirty = true;
+	};
+
+	//Per-worker buffers, reused across the chunks a worker meshes
+	struct chunkScratch
+	{
+		std::vector<float> blurX, blurY, density;
+		std::vector<uint32_t> vertexIndex;
+	};
+
+	int size[3];
+	int chunkCount[3];
+	float voxelSpacing;
+	float isoLevel;
+	JobSystem& jobs;
+	WorkerLocal<chunkScratch> scratch;
+	std::vector<uint8_t> occupancy;
+	std::vector<uint8_t> previousOccupancy;
+	std::vector<surfaceChunk> chunks;
+	std::vector<surfaceVertex> meshVertices;
+	std::vector<uint32_t> meshIndices;
+	//Gather scratch: the first mesh vertex of each chunk, and the mesh vertex of each border entry of the chunk at hand
+	std::vector<uint32_t> chunkBase;
+	std::vector<uint32_t> borderIndex;
+
+	size_t occupancyIndex(int x, int y, int z) const
+	{
+		return ((size_t)(z + 2) * (size[1] + 4) + (y + 2)) * (size[0] + 4) + (x + 2);
+	}
+
+	//Cubes run from -1 on each axis, so (-1, -1, -1) is cube 0
+	uint32_t cubeIndex(int x, int y, int z) const
+	{
+		return (uint32_t)((((size_t)z + 1) * (size[1] + 1) + (y + 1)) * (size[0] + 1) + (x + 1));
+	}
+
+	//Cube q belongs to chunk (q + 1) / CHUNK
+	uint32_t cubeChunk(int x, int y, int z) const
+	{
+		return (uint32_t)((((size_t)z + 1) / CHUNK * chunkCount[1] + (y + 1) / CHUNK) * chunkCount[0] + (x + 1) / CHUNK);
+	}
+
+	//A changed cell moves the densities within 1 cell, which move the vertices of the cubes within 2 cells, which are
+	//used by quads owned by cubes up to 1 further along
+	void markChangedChunks()
+	{
+		for (int z = 0; z < size[2]; z++)
+		{
+			for (int y = 0; y < size[1]; y++)
+			{
+				for (int x = 0; x < size[0]; x++)
+				{
+					size_t i = occupancyIndex(x, y, z);
+					if (occupancy[i] == previousOccupancy[i])
+						continue;
+
+					int cell[3] = { x, y, z };
+					int low[3], high[3];
+					for (int axis = 0; axis < 3; axis++)
+					{
+						//Cube q belongs to chunk (q + 1) / CHUNK
+						low[axis] = std::max(cell[axis] - 2 + 1, 0) / CHUNK;
+						high[axis] = std::min((cell[axis] + 2 + 1) / CHUNK, chunkCount[axis] - 1);
+					}
+					for (int cz = low[2]; cz <= high[2]; cz++)
+						for (int cy = low[1]; cy <= high[1]; cy++)
+							for (int cx = low[0]; cx <= high[0]; cx++)
+								chunks[((size_t)cz * chunkCount[1] + cy) * chunkCount[0] + cx].dirty = true;
+				}
+			}
+		}
+	}
+
+	void meshChunk(int chunkIndex, chunkScratch& scratch)
+	{
+		surfaceChunk& chunk = chunks[chunkIndex];
+		int chunkPos[3] = { chunkIndex % chunkCount[0], (chunkIndex / chunkCount[0]) % chunkCount[1], chunkIndex / (chunkCount[0] * chunkCount[1]) };
+
+		//Owned cubes are [begin, end). Vertices are also needed for the cubes one below, whose quads reach into this chunk,
+		//so vertices cover [first, end) and densities cover their corners [first, end].
+		int begin[3], end[3], first[3], n[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			begin[axis] = chunkPos[axis] * CHUNK - 1;
+			end[axis] = std::min(begin[axis] + CHUNK, size[axis]);
+			first[axis] = std::max(begin[axis] - 1, -1);
+			n[axis] = end[axis] - first[axis] + 1;
+		}
+		blurDensity(scratch, first, n);
+		const float* density = scratch.density.data();
+		//Corner pairs of a cube's 12 edges
+		static const int cubeEdges[12][2] = { {0,1},{2,3},{4,5},{6,7}, {0,2},{1,3},{4,6},{5,7}, {0,4},{1,5},{2,6},{3,7} };
+		//Offsets of a cube's 8 corners from its lowest one; corner i is at (i & 1, i >> 1 & 1, i >> 2 & 1)
+		const size_t dx = 1, dy = n[0], dz = (size_t)n[0] * n[1];
+		const size_t cornerOffset[8] = { 0, dx, dy, dx + dy, dz, dx + dz, dy + dz, dx + dy + dz };
+
+		chunk.vertices.clear();
+		chunk.indices.clear();
+		chunk.seam.clear();
+		chunk.border.clear();
+		//Last owned cube on each axis, on the face the chunk above meshes against
+		int last[3] = { begin[0] + CHUNK - 1, begin[1] + CHUNK - 1, begin[2] + CHUNK - 1 };
+		//Vertex of each cube, indexed like the densities (the last row on each axis is unused)
+		scratch.vertexIndex.resize(scratch.density.size());
+
+		for (int z = first[2]; z < end[2]; z++)
+		{
+			for (int y = first[1]; y < end[1]; y++)
+			{
+				size_t row = ((size_t)(z - first[2]) * n[1] + (y - first[1])) * n[0] - first[0];
+				for (int x = first[0]; x < end[0]; x++)
+				{
+					size_t i = row + x;
+					float corner[8];
+					int inside = 0;
+					for (int k = 0; k < 8; k++)
+					{
+						corner[k] = density[i + cornerOffset[k]];
+						inside |= (corner[k] > isoLevel) << k;
+					}
+					if (inside == 0 || inside == 0xff)
+						continue;
+
+					//Cubes of the chunks below only need their vertex's place, which the gather finds in the chunk that owns them
+					if (x < begin[0] || y < begin[1] || z < begin[2])
+					{
+						scratch.vertexIndex[i] = BORDER_VERTEX | (uint32_t)chunk.border.size();
+						chunk.border.push_back({ cubeChunk(x, y, z), cubeIndex(x, y, z) });
+						continue;
+					}
+
+					//Mean of the crossings on the edges whose ends differ
+					float sum[3] = { 0.0f, 0.0f, 0.0f };
+					int crossings = 0;
+					for (const int* edge : cubeEdges)
+					{
+						if (((inside >> edge[0]) ^ (inside >> edge[1])) & 1)
+						{
+							float t = (isoLevel - corner[edge[0]]) / (corner[edge[1]] - corner[edge[0]]);
+							for (int axis = 0; axis < 3; axis++)
+							{
+								int from = edge[0] >> axis & 1, to = edge[1] >> axis & 1;
+								sum[axis] += from + (to - from) * t;
+							}
+							crossings++;
+						}
+					}
+
+					//Density falls outwards, so the normal is minus the gradient, averaged over the cube's 4 edges per axis
+					glm::vec3 gradient(
+						corner[1] - corner[0] + corner[3] - corner[2] + corner[5] - corner[4] + corner[7] - corner[6],
+						corner[2] - corner[0] + corner[3] - corner[1] + corner[6] - corner[4] + corner[7] - corner[5],
+						corner[4] - corner[0] + corner[5] - corner[1] + corner[6] - corner[2] + corner[7] - corner[3]);
+					float gradientLength = glm::length(gradient);
+
+					surfaceVertex vertex;
+					//Cell centres are at cell * voxelSpacing, like the cube instances
+					vertex.position = glm::vec3(x + sum[0] / crossings, y + sum[1] / crossings, z + sum[2] / crossings) * voxelSpacing;
+					vertex.normal = gradientLength > 0.0f ? gradient * (-1.0f / gradientLength) : glm::vec3(0.0f, 1.0f, 0.0f);
+					uint32_t v0 = (uint32_t)chunk.vertices.size();
+					scratch.vertexIndex[i] = v0;
+					chunk.vertices.push_back(vertex);
+					if (x == last[0] || y == last[1] || z == last[2])
+						chunk.seam.push_back({ cubeIndex(x, y, z), v0 });
+
+					//Owned cubes emit the quads for the 3 edges leaving their lowest corner. The other 3 cubes around such an
+					//edge are one lower on the other two axes, so the loop order has already given them vertices.
+					int q[3] = { x, y, z };
+					bool startInside = inside & 1;
+					for (int a = 0; a < 3; a++)
+					{
+						int b = (a + 1) % 3, c = (a + 2) % 3;
+						//Corner 1 << a is the far end of the edge along a
+						if (startInside == (bool)(inside >> (1 << a) & 1))
+							continue;
+						//Edges on the padding layer never cross, since the density there is below 1/6
+						if (q[b] == -1 || q[c] == -1)
+							continue;
+						size_t stepB = cornerOffset[1 << b], stepC = cornerOffset[1 << c];
+						uint32_t v1 = scratch.vertexIndex[i - stepB];
+						uint32_t v2 = scratch.vertexIndex[i - stepB - stepC];
+						uint32_t v3 = scratch.vertexIndex[i - stepC];
+						//Counter-clockwise seen from +a; flip when the outside is towards -a
+						if (!startInside)
+							std::swap(v1, v3);
+						uint32_t quad[6] = { v0, v1, v2, v0, v2, v3 };
+						chunk.indices.insert(chunk.indices.end(), quad, quad + 6);
+					}
+				}
+			}
+		}
+		chunk.dirty = false;
+	}
+
+	//density = occupancy blurred with [1 4 1] / 6 along x, then y, then z, over the n^3 cell centres starting at first
+	void blurDensity(chunkScratch& scratch, const int* first, const int* n)
+	{
+		//Each pass widens the region the next one reads by 1 cell on the axes not yet blurred
+		int ny = n[1] + 2, nz = n[2] + 2;
+		scratch.blurX.resize((size_t)n[0] * ny * nz);
+		for (int z = 0; z < nz; z++)
+		{
+			for (int y = 0; y < ny; y++)
+			{
+				const uint8_t* row = &occupancy[occupancyIndex(first[0], first[1] - 1 + y, first[2] - 1 + z)];
+				float* out = &scratch.blurX[((size_t)z * ny + y) * n[0]];
+				for (int x = 0; x < n[0]; x++)
+					out[x] = (row[x - 1] + 4.0f * row[x] + row[x + 1]) / 6.0f;
+			}
+		}
+
+		scratch.blurY.resize((size_t)n[0] * n[1] * nz);
+		for (int z = 0; z < nz; z++)
+		{
+			for (int y = 0; y < n[1]; y++)
+			{
+				const float* in = &scratch.blurX[((size_t)z * ny + y + 1) * n[0]];
+				float* out = &scratch.blurY[((size_t)z * n[1] + y) * n[0]];
+				for (int x = 0; x < n[0]; x++)
+					out[x] = (in[x - n[0]] + 4.0f * in[x] + in[x + n[0]]) / 6.0f;
+			}
+		}
+
+		size_t slice = (size_t)n[0] * n[1];
+		scratch.density.resize(slice * n[2]);
+		for (int z = 0; z < n[2]; z++)
+		{
+			const float* in = &scratch.blurY[(z + 1) * slice];
+			float* out = &scratch.density[z * slice];
+			for (size_t i = 0; i < slice; i++)
+				out[i] = (in[i - slice] + 4.0f * in[i] + in[i + slice]) / 6.0f;
+		}
+	}
+
+	//Concatenates the chunk meshes, offsetting each chunk's indices by the vertices before it. Border vertices are found
+	//by cube in the seam list of the chunk that owns them, which is sorted because chunks are meshed in cube order.
+	void gatherChunks()
+	{
+		size_t vertexTotal = 0, indexTotal = 0;
+		chunkBase.resize(chunks.size());
+		for (size_t c = 0; c < chunks.size(); c++)
+		{
+			chunkBase[c] = (uint32_t)vertexTotal;
+			vertexTotal += chunks[c].vertices.size();
+			indexTotal += chunks[c].indices.size();
+		}
+		meshVertices.resize(vertexTotal);
+		meshIndices.resize(indexTotal);
+
+		size_t indexBase = 0;
+		for (size_t c = 0; c < chunks.size(); c++)
+		{
+			const surfaceChunk& chunk = chunks[c];
+			std::copy(chunk.vertices.begin(), chunk.vertices.end(), meshVertices.begin() + chunkBase[c]);
+
+			borderIndex.resize(chunk.border.size());
+			for (size_t b = 0; b < chunk.border.size(); b++)
+			{
+				const std::vector<seamVertex>& seam = chunks[chunk.border[b].chunk].seam;
+				auto owned = std::lower_bound(seam.begin(), seam.end(), chunk.border[b].cube,
+					[](const seamVertex& entry, uint32_t cube) { return entry.cube < cube; });
+				borderIndex[b] = chunkBase[chunk.border[b].chunk] + owned->vertex;
+			}
+
+			for (size_t i = 0; i < chunk.indices.size(); i++)
+			{
+				uint32_t v = chunk.indices[i];
+				meshIndices[indexBase + i] = (v & BORDER_VERTEX) ? borderIndex[v & ~BORDER_VERTEX] : v + chunkBase[c];
+			}
+			indexBase += chunk.indices.size();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef SURFACE_RENDERER_H
+#define SURFACE_RENDERER_H
+
+#include "shaderHelper.h"
+#include "surfaceMesher.h"
+#include "frameUniforms.h"
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <algorithm>
+
+//Draws the fluid as the smooth surface built by SurfaceMesher instead of one cube per voxel. The whole mesh lives in one
+//vertex and one index buffer and goes out in a single glDrawElements call. The buffers are only uploaded when a chunk
+//was remeshed, and are regrown with doubled capacity when the mesh outgrows them.
+
+class SurfaceRenderer
+{
+public:
+	ShaderHelper shader;
+	SurfaceMesher mesher;
+
+	//Needs a current context
+	SurfaceRenderer(int x, int y, int z, float voxelSpacing, JobSystem& jobs, bool useShaderCache)
+		: shader("surfaceMesh.vert", "surfaceMesh.frag", true, useShaderCache), mesher(x, y, z, voxelSpacing, jobs)
+	{
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(surfaceVertex), (void*)offsetof(surfaceVertex, position));
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(surfaceVertex), (void*)offsetof(surfaceVertex, normal));
+		glEnableVertexAttribArray(1);
+		shader.bindUniformBlock("FrameData", FrameUniformBuffer::BINDING);
+	}
+
+	//Remeshes the chunks whose occupancy changed and uploads the mesh if anything was remeshed. Scratch lists come
+	//from arena.
+	template <typename Grid>
+	void upload(const Grid& grid, FrameArena& arena)
+	{
+		mesher.update(grid, arena);
+		if (mesher.lastRemeshedChunks == 0)
+			return;
+
+		const std::vector<surfaceVertex>& vertices = mesher.vertices();
+		const std::vector<uint32_t>& indices = mesher.indices();
+		glBindVertexArray(VAO);
+		writeBuffer(GL_ARRAY_BUFFER, VBO, vertexCapacity, vertices.size() * sizeof(surfaceVertex), vertices.data());
+		writeBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO, indexCapacity, indices.size() * sizeof(uint32_t), indices.data());
+		indexCount = (int)indices.size();
+	}
+
+	void draw(const glm::mat4& modelToWorld)
+	{
+		shader.reloadIfChanged();
+		shader.use();
+		shader.setMat4("modelToWorld", modelToWorld);
+		glBindVertexArray(VAO);
+		glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+	}
+
+private:
+	unsigned int VAO, VBO, EBO;
+	size_t vertexCapacity = 0;
+	size_t indexCapacity = 0;
+	int indexCount = 0;
+
+	static void writeBuffer(GLenum target, unsigned int buffer, size_t& capacity, size_t bytes, const void* data)
+	{
+		glBindBuffer(target, buffer);
+		if (bytes > capacity)
+		{
+			capacity = std::max(bytes, capacity * 2);
+			glBufferData(target, capacity, NULL, GL_DYNAMIC_DRAW);
+		}
+		if (bytes > 0)
+			glBufferSubData(target, 0, bytes, data);
+	}
+};
+
+#endif
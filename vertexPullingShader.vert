@@ -0,0 +1,54 @@
+#version 460 core
+
+//Vertex pulling: no vertex attributes. Drawn with glDrawArrays(GL_TRIANGLES, 0, voxels * 36); gl_VertexID / 36 picks the
+//voxel and gl_VertexID % 36 the corner of one of its 12 triangles.
+
+//Cell coordinates packed 10-10-10 with a 2 bit material on top, see voxelInstance.h
+layout (std430, binding = 0) readonly buffer VoxelBuffer
+{
+    uint packedCells[];
+};
+
+out vec3 localPos;
+//Colour index from the top two bits: water, sand, oil, solid
+flat out uint material;
+
+uniform mat4 modelToWorld;
+uniform float voxelSpacing;
+//A cell at lodLevel covers 2^lodLevel voxels per axis, see occupancyPyramid.h
+uniform int lodLevel;
+
+//Per-frame state, see frameUniforms.h
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+    mat4 inverseViewProjection;
+};
+
+//Same triangles as cubeTriIndices in main.cpp. Corner c is at (c & 1, (c >> 1) & 1, (c >> 2) & 1) mapped to -1/1.
+const uint cubeTriIndices[36] = uint[36](
+	0, 1, 2,  1, 2, 3,
+	4, 5, 6,  5, 6, 7,
+	0, 1, 4,  4, 5, 1,
+	2, 3, 7,  7, 6, 2,
+	0, 2, 4,  2, 4, 6,
+	1, 3, 5,  3, 5, 7);
+
+//Remember to multiply in reverse order
+void main()
+{
+	uint packedCell = packedCells[gl_VertexID / 36];
+	uint corner = cubeTriIndices[gl_VertexID % 36];
+	vec3 aPos = vec3(uvec3(corner, corner >> 1, corner >> 2) & 1u) * 2.0 - 1.0;
+
+	localPos = aPos;
+	material = packedCell >> 30;
+	uvec3 cell = uvec3(packedCell, packedCell >> 10, packedCell >> 20) & 1023u;
+	float span = float(1 << lodLevel);
+	vec3 aOffset = (vec3(cell) * span + (span - 1.0) * 0.5) * voxelSpacing;
+    gl_Position = viewProjection * modelToWorld * (vec4(aPos * (1.0 + (span - 1.0) * voxelSpacing * 0.5) + aOffset, 1.0));
+}
@@ -0,0 +1,134 @@
+#version 460 core
+
+//Ray marches the occupancy textures uploaded by VolumeRenderer, see volumeRenderer.h. The ray is clipped to the grid,
+//walked block by block through the coarse texture, and walked cell by cell only inside occupied blocks.
+
+in vec2 ndc;
+out vec4 FragColor;
+
+uniform usampler3D occupancy;
+uniform usampler3D blocks;
+uniform ivec3 gridSize;
+uniform float voxelSpacing;
+
+//Per-frame state, see frameUniforms.h
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+    mat4 inverseViewProjection;
+};
+
+//Must match VolumeRenderer::BLOCK
+const int BLOCK = 8;
+const float EPSILON = 1e-4;
+
+//Cell space: cell c spans [c, c + 1], and origin + direction * t is the point at world distance t along the ray.
+//Walks the cells between tStart and tEnd (Amanatides-Woo) and returns the first occupied one with the t it is entered at.
+bool marchCells(vec3 origin, vec3 direction, float tStart, float tEnd, out ivec3 cell, out float tHit)
+{
+	ivec3 stepDir = ivec3(sign(direction));
+	vec3 invDirection = 1.0 / direction;
+	cell = clamp(ivec3(floor(origin + direction * (tStart + EPSILON))), ivec3(0), gridSize - 1);
+	vec3 tNext = (vec3(cell + max(stepDir, 0)) - origin) * invDirection;
+	vec3 tDelta = abs(invDirection);
+
+	tHit = tStart;
+	for (int i = 0; i < 3 * BLOCK + 3 && tHit < tEnd; i++)
+	{
+		if (texelFetch(occupancy, cell, 0).r != 0u)
+			return true;
+
+		if (tNext.x <= tNext.y && tNext.x <= tNext.z)
+		{
+			tHit = tNext.x;
+			cell.x += stepDir.x;
+			tNext.x += tDelta.x;
+		}
+		else if (tNext.y <= tNext.z)
+		{
+			tHit = tNext.y;
+			cell.y += stepDir.y;
+			tNext.y += tDelta.y;
+		}
+		else
+		{
+			tHit = tNext.z;
+			cell.z += stepDir.z;
+			tNext.z += tDelta.z;
+		}
+		if (any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, gridSize)))
+			return false;
+	}
+	return false;
+}
+
+void main()
+{
+	vec4 farPoint = inverseViewProjection * vec4(ndc, 1.0, 1.0);
+	vec3 rayDirection = normalize(farPoint.xyz / farPoint.w - cameraPosition);
+	//Axis-parallel rays would give 0 * inf below
+	rayDirection = mix(rayDirection, vec3(1e-7), equal(rayDirection, vec3(0.0)));
+
+	vec3 origin = cameraPosition / voxelSpacing + 0.5;
+	vec3 direction = rayDirection / voxelSpacing;
+
+	//Clip to the grid box
+	vec3 tLow = -origin / direction;
+	vec3 tHigh = (vec3(gridSize) - origin) / direction;
+	vec3 tMin = min(tLow, tHigh);
+	vec3 tMax = max(tLow, tHigh);
+	float tEnter = max(max(max(tMin.x, tMin.y), tMin.z), 0.0);
+	float tExit = min(min(tMax.x, tMax.y), tMax.z);
+	if (tEnter >= tExit)
+		discard;
+
+	//Block DDA, same scheme as marchCells with BLOCK sized cells
+	ivec3 blockCount = (gridSize + BLOCK - 1) / BLOCK;
+	ivec3 stepDir = ivec3(sign(direction));
+	vec3 invDirection = 1.0 / direction;
+	ivec3 block = clamp(ivec3(floor((origin + direction * (tEnter + EPSILON)) / float(BLOCK))), ivec3(0), blockCount - 1);
+	vec3 tNext = (vec3(block + max(stepDir, 0)) * float(BLOCK) - origin) * invDirection;
+	vec3 tDelta = abs(float(BLOCK) * invDirection);
+
+	float tBlock = tEnter;
+	int maxSteps = blockCount.x + blockCount.y + blockCount.z + 3;
+	for (int i = 0; i < maxSteps && tBlock < tExit; i++)
+	{
+		float tBlockExit = min(min(min(tNext.x, tNext.y), tNext.z), tExit);
+		ivec3 cell;
+		float tHit;
+		if (texelFetch(blocks, block, 0).r != 0u && marchCells(origin, direction, tBlock, tBlockExit, cell, tHit))
+		{
+			//Colour like the rasterized cube: position inside the cell mapped to [-1, 1]
+			vec3 hit = cameraPosition + rayDirection * tHit;
+			FragColor = vec4((hit - vec3(cell) * voxelSpacing) / (0.5 * voxelSpacing), 1.0);
+			vec4 clip = viewProjection * vec4(hit, 1.0);
+			gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+			return;
+		}
+
+		tBlock = tBlockExit;
+		if (tNext.x <= tNext.y && tNext.x <= tNext.z)
+		{
+			block.x += stepDir.x;
+			tNext.x += tDelta.x;
+		}
+		else if (tNext.y <= tNext.z)
+		{
+			block.y += stepDir.y;
+			tNext.y += tDelta.y;
+		}
+		else
+		{
+			block.z += stepDir.z;
+			tNext.z += tDelta.z;
+		}
+		if (any(lessThan(block, ivec3(0))) || any(greaterThanEqual(block, blockCount)))
+			break;
+	}
+	discard;
+}
@@ -0,0 +1,10 @@
+#version 460 core
+
+//One triangle covering the screen, drawn with glDrawArrays(GL_TRIANGLES, 0, 3) and no vertex attributes
+out vec2 ndc;
+
+void main()
+{
+	ndc = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(ndc, 0.0, 1.0);
+}
@@ -0,0 +1,106 @@
+#ifndef VOLUME_RENDERER_H
+#define VOLUME_RENDERER_H
+
+#include "shaderHelper.h"
+#include "voxelGrid.h"
+#include "frameUniforms.h"
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+//Alternative to drawing one cube instance per voxel: occupancy is uploaded as a 3D texture and a fullscreen fragment
+//shader ray-marches it, so the cost follows the number of pixels rather than the number of voxels.
+//
+//Besides the per-cell texture there is a coarse texture with one texel per BLOCK^3 cells that is nonzero if any of them
+//is occupied. volumeRayMarch.frag walks the coarse texture with a DDA and only runs the per-cell DDA inside occupied
+//blocks, which skips empty space in BLOCK sized steps.
+//
+//Cell c is the box [c - 0.5, c + 0.5] * voxelSpacing, which is exactly the rasterized cube when voxelSpacing is 2 (the
+//cube is always 2 units wide). The shader colours hits like defaultFragmentShader.frag and writes depth.
+
+class VolumeRenderer
+{
+public:
+	enum { BLOCK = 8 };
+
+	ShaderHelper shader;
+
+	//Needs a current context
+	VolumeRenderer(int x, int y, int z, bool useShaderCache)
+		: shader("volumeRayMarch.vert", "volumeRayMarch.frag", true, useShaderCache), sizeX(x), sizeY(y), sizeZ(z)
+	{
+		blocksX = (x + BLOCK - 1) / BLOCK;
+		blocksY = (y + BLOCK - 1) / BLOCK;
+		blocksZ = (z + BLOCK - 1) / BLOCK;
+		cells.assign((size_t)x * y * z, 0);
+		blocks.assign((size_t)blocksX * blocksY * blocksZ, 0);
+
+		glGenVertexArrays(1, &emptyVAO);
+		occupancyTexture = createTexture(x, y, z);
+		blockTexture = createTexture(blocksX, blocksY, blocksZ);
+		shader.bindUniformBlock("FrameData", FrameUniformBuffer::BINDING);
+	}
+
+	//Copies the grid's occupancy into both textures
+	template <typename Grid>
+	void upload(const Grid& grid)
+	{
+		std::fill(cells.begin(), cells.end(), 0);
+		std::fill(blocks.begin(), blocks.end(), 0);
+		grid.forEachVoxel([&](int x, int y, int z, const voxelPosition&)
+		{
+			//Textures are addressed x fastest
+			cells[((size_t)z * sizeY + y) * sizeX + x] = 1;
+			blocks[((size_t)(z / BLOCK) * blocksY + y / BLOCK) * blocksX + x / BLOCK] = 1;
+		});
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glBindTexture(GL_TEXTURE_3D, occupancyTexture);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, sizeX, sizeY, sizeZ, GL_RED_INTEGER, GL_UNSIGNED_BYTE, cells.data());
+		glBindTexture(GL_TEXTURE_3D, blockTexture);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, blocksX, blocksY, blocksZ, GL_RED_INTEGER, GL_UNSIGNED_BYTE, blocks.data());
+	}
+
+	//Draws one fullscreen triangle. Camera state comes from the FrameData uniform buffer.
+	void draw(float voxelSpacing)
+	{
+		shader.reloadIfChanged();
+		shader.use();
+		shader.setInt("occupancy", 0);
+		shader.setInt("blocks", 1);
+		shader.setFloat("voxelSpacing", voxelSpacing);
+		glUniform3i(shader.uniformLocation("gridSize"), sizeX, sizeY, sizeZ);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_3D, occupancyTexture);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_3D, blockTexture);
+		glActiveTexture(GL_TEXTURE0);
+
+		glBindVertexArray(emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+private:
+	int sizeX, sizeY, sizeZ;
+	int blocksX, blocksY, blocksZ;
+	std::vector<uint8_t> cells;
+	std::vector<uint8_t> blocks;
+	unsigned int emptyVAO;
+	unsigned int occupancyTexture;
+	unsigned int blockTexture;
+
+	static unsigned int createTexture(int x, int y, int z)
+	{
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_3D, texture);
+		//Integer textures must not be filtered
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, x, y, z, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
+		return texture;
+	}
+};
+
+#endif
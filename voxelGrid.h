@@ -0,0 +1,245 @@
+#ifndef VOXEL_GRID_H
+#define VOXEL_GRID_H
+
+#include "voxelMaterial.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+//This header holds the cell types shared by every voxel grid, plus the dense grid layouts.
+//Every grid exposes the same small interface so the simulation and instance builder can be written once:
+//  sizeX/sizeY/sizeZ                - domain dimensions in cells
+//  containsVoxel(x, y, z)           - occupancy test, false outside the domain
+//  at(x, y, z)                      - reference to an occupied cell
+//  materialAt(x, y, z)              - material of a cell, MATERIAL_EMPTY if it is empty or outside the domain
+//  placeVoxel(x, y, z, velocity, material) - mark a cell occupied, by water unless material says otherwise
+//  removeVoxel(x, y, z)             - mark a cell empty
+//  sweep(f)                         - call f(x, y, z) for each occupied cell, re-checking occupancy as it goes
+//  forEachVoxel(f)                  - call f(x, y, z, cell) for each occupied cell (read only)
+//  memoryBytes()                    - bytes held by the grid storage
+//concurrentReads<Grid>::value says whether containsVoxel and forEachVoxel may run on several threads at once. Layouts
+//that cache lookups inside those const calls (the sparse accessor, the paged chunk cache) leave it at 0, and parallel
+//readers fall back to one thread for them.
+
+template <typename Grid>
+struct concurrentReads { enum { value = 0 }; };
+
+struct vec3Int
+{
+	int x = 0;
+	int y = 0;
+	int z = 0;
+	vec3Int() {}
+	vec3Int(int _x, int _y, int _z)
+	{
+		x = _x;
+		y = _y;
+		z = _z;
+	}
+};
+
+struct voxelPosition
+{
+	bool containsVoxel = false;
+	//voxelMaterial, see voxelMaterial.h
+	uint8_t material = MATERIAL_EMPTY;
+	//Position inside the cell for the swept velocity rule, see voxelTraversal.h
+	int8_t offset[3] = { 0, 0, 0 };
+
+	glm::vec3 velocity = glm::vec3(0.0f);
+
+	voxelPosition() {}
+};
+
+//Row-major dense grid, z fastest. This is the layout the simulation was written against.
+class DenseVoxelGrid
+{
+public:
+	const int sizeX;
+	const int sizeY;
+	const int sizeZ;
+
+	DenseVoxelGrid(int x, int y, int z) : sizeX(x), sizeY(y), sizeZ(z), cells((size_t)x * y * z) {}
+
+	bool containsVoxel(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return false;
+		return cells[index(x, y, z)].containsVoxel;
+	}
+
+	voxelPosition& at(int x, int y, int z)
+	{
+		return cells[index(x, y, z)];
+	}
+
+	uint8_t materialAt(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return MATERIAL_EMPTY;
+		return cells[index(x, y, z)].material;
+	}
+
+	void placeVoxel(int x, int y, int z, glm::vec3 velocity = glm::vec3(0.0f), uint8_t material = MATERIAL_WATER)
+	{
+		voxelPosition& cell = cells[index(x, y, z)];
+		cell.containsVoxel = true;
+		cell.material = material;
+		cell.velocity = velocity;
+	}
+
+	void removeVoxel(int x, int y, int z)
+	{
+		cells[index(x, y, z)] = voxelPosition();
+	}
+
+	template <typename F>
+	void sweep(F f)
+	{
+		for (int i = 0; i < sizeX; i++)
+			for (int j = 0; j < sizeY; j++)
+				for (int k = 0; k < sizeZ; k++)
+					if (cells[index(i, j, k)].containsVoxel)
+						f(i, j, k);
+	}
+
+	template <typename F>
+	void forEachVoxel(F f) const
+	{
+		for (int i = 0; i < sizeX; i++)
+			for (int j = 0; j < sizeY; j++)
+				for (int k = 0; k < sizeZ; k++)
+					if (cells[index(i, j, k)].containsVoxel)
+						f(i, j, k, cells[index(i, j, k)]);
+	}
+
+	size_t memoryBytes() const
+	{
+		return cells.size() * sizeof(voxelPosition);
+	}
+
+private:
+	std::vector<voxelPosition> cells;
+
+	size_t index(int x, int y, int z) const
+	{
+		return ((size_t)x * sizeY + y) * sizeZ + z;
+	}
+};
+
+template <>
+struct concurrentReads<DenseVoxelGrid> { enum { value = 1 }; };
+
+//Dense grid stored in Morton (Z-order) so the +-x, +-y and +-z neighbours of a cell usually share a cache line or page.
+//Storage is padded to a power-of-two cube; padding cells are never occupied.
+class MortonVoxelGrid
+{
+public:
+	const int sizeX;
+	const int sizeY;
+	const int sizeZ;
+
+	MortonVoxelGrid(int x, int y, int z) : sizeX(x), sizeY(y), sizeZ(z)
+	{
+		int largest = std::max(x, std::max(y, z));
+		paddedSize = 1;
+		while (paddedSize < largest)
+			paddedSize <<= 1;
+		cells.resize((size_t)paddedSize * paddedSize * paddedSize);
+	}
+
+	bool containsVoxel(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return false;
+		return cells[index(x, y, z)].containsVoxel;
+	}
+
+	voxelPosition& at(int x, int y, int z)
+	{
+		return cells[index(x, y, z)];
+	}
+
+	uint8_t materialAt(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+			return MATERIAL_EMPTY;
+		return cells[index(x, y, z)].material;
+	}
+
+	void placeVoxel(int x, int y, int z, glm::vec3 velocity = glm::vec3(0.0f), uint8_t material = MATERIAL_WATER)
+	{
+		voxelPosition& cell = cells[index(x, y, z)];
+		cell.containsVoxel = true;
+		cell.material = material;
+		cell.velocity = velocity;
+	}
+
+	void removeVoxel(int x, int y, int z)
+	{
+		cells[index(x, y, z)] = voxelPosition();
+	}
+
+	//Walks storage order rather than i, j, k so the sweep itself streams through memory
+	template <typename F>
+	void sweep(F f)
+	{
+		for (size_t n = 0; n < cells.size(); n++)
+			if (cells[n].containsVoxel)
+				f(compactBy3(n >> 2), compactBy3(n >> 1), compactBy3(n));
+	}
+
+	template <typename F>
+	void forEachVoxel(F f) const
+	{
+		for (size_t n = 0; n < cells.size(); n++)
+			if (cells[n].containsVoxel)
+				f(compactBy3(n >> 2), compactBy3(n >> 1), compactBy3(n), cells[n]);
+	}
+
+	size_t memoryBytes() const
+	{
+		return cells.size() * sizeof(voxelPosition);
+	}
+
+	//Spreads the low 21 bits of a so there are two zero bits between each
+	static uint64_t splitBy3(uint32_t a)
+	{
+		uint64_t x = a & 0x1fffff;
+		x = (x | x << 32) & 0x1f00000000ffffull;
+		x = (x | x << 16) & 0x1f0000ff0000ffull;
+		x = (x | x << 8) & 0x100f00f00f00f00full;
+		x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+		x = (x | x << 2) & 0x1249249249249249ull;
+		return x;
+	}
+
+	//Inverse of splitBy3
+	static int compactBy3(uint64_t x)
+	{
+		x &= 0x1249249249249249ull;
+		x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3ull;
+		x = (x ^ (x >> 4)) & 0x100f00f00f00f00full;
+		x = (x ^ (x >> 8)) & 0x1f0000ff0000ffull;
+		x = (x ^ (x >> 16)) & 0x1f00000000ffffull;
+		x = (x ^ (x >> 32)) & 0x1fffffull;
+		return (int)x;
+	}
+
+private:
+	int paddedSize;
+	std::vector<voxelPosition> cells;
+
+	//z in the lowest bit so z neighbours stay adjacent, as in the row-major layout
+	static size_t index(int x, int y, int z)
+	{
+		return (size_t)((splitBy3(x) << 2) | (splitBy3(y) << 1) | splitBy3(z));
+	}
+};
+
+template <>
+struct concurrentReads<MortonVoxelGrid> { enum { value = 1 }; };
+
+#endif
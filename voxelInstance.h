@@ -0,0 +1,37 @@
+#ifndef VOXEL_INSTANCE_H
+#define VOXEL_INSTANCE_H
+
+#include <cstdint>
+
+//Per-instance data for one drawn voxel: its integer cell coordinates packed 10-10-10 into one 32-bit word, leaving the
+//top two bits for a material or colour index. The vertex shader reads it with glVertexAttribIPointer, unpacks it with
+//shifts and scales it by voxelSpacing, so an instance costs 4 bytes instead of three floats. Axes are limited to 1024
+//cells.
+//
+//	bits 0-9 x, 10-19 y, 20-29 z, 30-31 material
+
+typedef uint32_t packedVoxel;
+
+const int PACKED_COORD_BITS = 10;
+const int PACKED_COORD_LIMIT = 1 << PACKED_COORD_BITS;
+const uint32_t PACKED_COORD_MASK = PACKED_COORD_LIMIT - 1;
+const int PACKED_MATERIAL_SHIFT = 3 * PACKED_COORD_BITS;
+const uint32_t PACKED_MATERIAL_MASK = 3;
+
+inline packedVoxel packVoxel(int x, int y, int z, unsigned material = 0)
+{
+	return ((uint32_t)x & PACKED_COORD_MASK)
+		| (((uint32_t)y & PACKED_COORD_MASK) << PACKED_COORD_BITS)
+		| (((uint32_t)z & PACKED_COORD_MASK) << (2 * PACKED_COORD_BITS))
+		| ((material & PACKED_MATERIAL_MASK) << PACKED_MATERIAL_SHIFT);
+}
+
+inline void unpackVoxel(packedVoxel voxel, int& x, int& y, int& z, unsigned& material)
+{
+	x = voxel & PACKED_COORD_MASK;
+	y = (voxel >> PACKED_COORD_BITS) & PACKED_COORD_MASK;
+	z = (voxel >> (2 * PACKED_COORD_BITS)) & PACKED_COORD_MASK;
+	material = (voxel >> PACKED_MATERIAL_SHIFT) & PACKED_MATERIAL_MASK;
+}
+
+#endif
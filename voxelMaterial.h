@@ -0,0 +1,74 @@
+#ifndef VOXEL_MATERIAL_H
+#define VOXEL_MATERIAL_H
+
+#include <cstdint>
+#include <cstring>
+
+//Material held by a cell, one byte per cell in voxelPosition. Every material has a density; a movable material swaps
+//with a lighter one below it, so sand sinks through water and oil floats on it. Solid never moves and nothing moves
+//into it, which is also how the density rule sees obstacle cells and the floor. Liquids spread sideways over whatever
+//holds them up; granular materials only topple sideways onto a cell they can fall from.
+//
+//The rules read materials through materialFalls, a pair table generated at compile time from the densities, so the
+//update is a table lookup per cell pair rather than a chain of comparisons.
+
+enum voxelMaterial
+{
+	MATERIAL_EMPTY,
+	MATERIAL_WATER,
+	MATERIAL_SAND,
+	MATERIAL_OIL,
+	MATERIAL_SOLID,
+	MATERIAL_COUNT
+};
+
+//kg/m^3; only the order matters
+constexpr int materialDensity[MATERIAL_COUNT] = { 0, 1000, 1600, 900, 2500 };
+constexpr bool materialMovable[MATERIAL_COUNT] = { false, true, true, true, false };
+constexpr bool materialFlows[MATERIAL_COUNT] = { false, true, false, true, false };
+
+struct materialPairTable
+{
+	//falls[a][b]: a voxel of material a swaps with a cell of material b below it (or beside it, if it may spread)
+	uint8_t falls[MATERIAL_COUNT][MATERIAL_COUNT];
+};
+
+constexpr materialPairTable buildMaterialPairs()
+{
+	materialPairTable table = {};
+	for (int a = 0; a < MATERIAL_COUNT; a++)
+		for (int b = 0; b < MATERIAL_COUNT; b++)
+			table.falls[a][b] = materialMovable[a] && (b == MATERIAL_EMPTY || (materialMovable[b] && materialDensity[a] > materialDensity[b])) ? 1 : 0;
+	return table;
+}
+
+constexpr materialPairTable materialPairs = buildMaterialPairs();
+
+static_assert(materialPairs.falls[MATERIAL_SAND][MATERIAL_WATER] && materialPairs.falls[MATERIAL_WATER][MATERIAL_OIL]
+	&& !materialPairs.falls[MATERIAL_OIL][MATERIAL_WATER] && !materialPairs.falls[MATERIAL_WATER][MATERIAL_SOLID],
+	"material pair table doesn't follow the densities");
+
+//Name used by source files, or nullptr
+inline const char* materialName(int material)
+{
+	static const char* names[MATERIAL_COUNT] = { "empty", "water", "sand", "oil", "solid" };
+	return material >= 0 && material < MATERIAL_COUNT ? names[material] : nullptr;
+}
+
+//Material called name, or MATERIAL_EMPTY if there is none
+inline uint8_t parseMaterial(const char* name)
+{
+	for (int material = 1; material < MATERIAL_COUNT; material++)
+		if (strcmp(name, materialName(material)) == 0)
+			return (uint8_t)material;
+	return MATERIAL_EMPTY;
+}
+
+//Colour index for the two material bits of a packed instance (see voxelInstance.h): water, sand, oil and solid are 0-3.
+//Water is 0 so cells drawn without a material, such as merged level of detail cells, look like water.
+inline unsigned materialInstanceIndex(uint8_t material)
+{
+	return material > MATERIAL_EMPTY ? material - 1u : 0u;
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef VOXEL_TRAVERSAL_H
+#define VOXEL_TRAVERSAL_H
+
+#include "voxelGrid.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+//Swept movement for the velocity rule. A voxel's position is its cell plus the sub-cell offset kept in voxelPosition,
+//and a step moves it along its velocity with a 3D DDA (Amanatides and Woo): the walk visits every cell the segment
+//passes through, in order, and stops before the first one that is blocked, so fast voxels can't tunnel through others
+//or leave the grid however large the step. Where the caller knows a whole cube of cells is empty, the walk crosses it in
+//one jump, so long moves through open space cost about one check per cube rather than per cell. Sub-cell offsets let
+//velocities under a cell per step accumulate instead of being truncated away.
+
+//Offsets are stored in 1/SUBCELL_STEPS of a cell from the cell centre
+enum { SUBCELL_STEPS = 256 };
+
+//Continuous position of a voxel in cell (x, y, z), in cells; the cell spans [x, x + 1) on each axis
+inline glm::vec3 subcellPosition(const voxelPosition& cell, int x, int y, int z)
+{
+	return glm::vec3((float)x, (float)y, (float)z) + glm::vec3(0.5f)
+		+ glm::vec3((float)cell.offset[0], (float)cell.offset[1], (float)cell.offset[2]) / (float)SUBCELL_STEPS;
+}
+
+//Stores position as the offset of a voxel in cell (x, y, z), clamped to lie inside the cell
+inline void storeSubcellPosition(voxelPosition& cell, glm::vec3 position, int x, int y, int z)
+{
+	glm::vec3 offset = (position - glm::vec3((float)x, (float)y, (float)z) - glm::vec3(0.5f)) * (float)SUBCELL_STEPS;
+	for (int axis = 0; axis < 3; axis++)
+		cell.offset[axis] = (int8_t)std::min(std::max((int)std::lround(offset[axis]), -SUBCELL_STEPS / 2), SUBCELL_STEPS / 2 - 1);
+}
+
+struct traversalResult
+{
+	//Last free cell reached and the position in it
+	vec3Int cell;
+	glm::vec3 position;
+	//Set if the walk stopped early: the cell that stopped it and the normal of the face it was entered through
+	bool blocked = false;
+	vec3Int blockedCell;
+	glm::vec3 normal = glm::vec3(0.0f);
+	//Cells looked at, including the one that blocked, and empty cubes jumped over
+	int cellsVisited = 0;
+	int blocksSkipped = 0;
+};
+
+//Walks the segment from start to start + delta and returns where it ends, or where it stops in front of the first cell
+//blocked(x, y, z) is true for. The cell holding start is taken to be free. emptyBlock(x, y, z) returns a level L > 0 if
+//the 2^L cube of cells holding (x, y, z), aligned to multiples of 2^L, has no blocked cell, and 0 otherwise; the walk
+//then jumps to where the segment leaves the cube instead of visiting each cell in it.
+template <typename Blocked, typename EmptyBlock>
+traversalResult traverseCells(glm::vec3 start, glm::vec3 delta, Blocked blocked, EmptyBlock emptyBlock)
+{
+	traversalResult result;
+	int cell[3] = { (int)std::floor(start.x), (int)std::floor(start.y), (int)std::floor(start.z) };
+	glm::vec3 end = start + delta;
+	int endCell[3] = { (int)std::floor(end.x), (int)std::floor(end.y), (int)std::floor(end.z) };
+	int step[3];
+	float tMax[3];
+	float tDelta[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		step[axis] = delta[axis] > 0 ? 1 : (delta[axis] < 0 ? -1 : 0);
+		tDelta[axis] = step[axis] != 0 ? 1.0f / std::abs(delta[axis]) : INFINITY;
+	}
+	//Parameter at which the segment leaves the current cell on each axis, and the boundary crossings left to the end
+	//cell, which bounds the walk so rounding in tMax can't carry it past the end
+	int remaining = 0;
+	auto restart = [&]()
+	{
+		remaining = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			tMax[axis] = step[axis] != 0 ? ((float)(cell[axis] + (step[axis] > 0 ? 1 : 0)) - start[axis]) / delta[axis] : INFINITY;
+			remaining += std::abs(endCell[axis] - cell[axis]);
+		}
+	};
+	restart();
+	//Where the last jump left its cube. Rounding can put the cell after a jump back inside the cube it left, so a jump
+	//has to get further than the last one or the walk could keep jumping to the same place.
+	float tJumped = -1.0f;
+
+	while (remaining > 0)
+	{
+		int level = emptyBlock(cell[0], cell[1], cell[2]);
+		int low[3];
+		float tExit = INFINITY;
+		for (int axis = 0; level > 0 && axis < 3; axis++)
+		{
+			low[axis] = (cell[axis] >> level) << level;
+			if (step[axis] != 0)
+				tExit = std::min(tExit, ((float)(low[axis] + (step[axis] > 0 ? 1 << level : 0)) - start[axis]) / delta[axis]);
+		}
+		if (level > 0 && tExit > tJumped)
+		{
+			//Jump to the cell the segment leaves the cube through; it is free like the rest of the cube
+			tJumped = tExit;
+			result.blocksSkipped++;
+			if (tExit >= 1.0f)
+			{
+				for (int axis = 0; axis < 3; axis++)
+					cell[axis] = endCell[axis];
+				break;
+			}
+			glm::vec3 exit = start + delta * tExit;
+			for (int axis = 0; axis < 3; axis++)
+				cell[axis] = std::min(std::max((int)std::floor(exit[axis]), low[axis]), low[axis] + (1 << level) - 1);
+			restart();
+			if (remaining == 0)
+				break;
+		}
+
+		int axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+		if (tMax[axis] > 1.0f)
+			break;
+		int next[3] = { cell[0], cell[1], cell[2] };
+		next[axis] += step[axis];
+		result.cellsVisited++;
+		if (blocked(next[0], next[1], next[2]))
+		{
+			result.blocked = true;
+			result.blockedCell = vec3Int(next[0], next[1], next[2]);
+			result.normal[axis] = (float)-step[axis];
+			result.cell = vec3Int(cell[0], cell[1], cell[2]);
+			result.position = start + delta * tMax[axis];
+			return result;
+		}
+		cell[axis] = next[axis];
+		tMax[axis] += tDelta[axis];
+		remaining--;
+	}
+	result.cell = vec3Int(cell[0], cell[1], cell[2]);
+	result.position = end;
+	return result;
+}
+
+//Same walk visiting every cell
+template <typename Blocked>
+traversalResult traverseCells(glm::vec3 start, glm::vec3 delta, Blocked blocked)
+{
+	return traverseCells(start, delta, blocked, [](int, int, int) { return 0; });
+}
+
+//What the velocity rule did, summed over the steps it is given to
+struct sweptMoveStats
+{
+	long long voxels = 0;
+	//Ended in the cell they started in, so nothing was walked
+	long long withinCell = 0;
+	long long walked = 0;
+	long long cellsVisited = 0;
+	//Cubes of cells the obstacle distance field and the occupancy pyramid showed to be empty, so walks jumped them
+	long long blocksSkipped = 0;
+	long long blocked = 0;
+};
+
+//Cells the velocity rule moved a voxel into this step, which the sweep skips if it reaches them again: one bit per cell,
+//and the cells set so only they are cleared. Each grid stepped with the rule needs its own.
+class sweptMoveScratch
+{
+public:
+	//Sizes the bits for a grid of cells cells and clears what the last step set, even if it stopped part way
+	void begin(size_t cells)
+	{
+		if (bits.size() != (cells + 63) / 64)
+		{
+			bits.assign((cells + 63) / 64, 0);
+			set.clear();
+		}
+		for (size_t n : set)
+			bits[n >> 6] = 0;
+		set.clear();
+	}
+
+	bool arrived(size_t cell) const
+	{
+		return (bits[cell >> 6] >> (cell & 63)) & 1;
+	}
+
+	void markArrived(size_t cell)
+	{
+		bits[cell >> 6] |= (uint64_t)1 << (cell & 63);
+		set.push_back(cell);
+	}
+
+private:
+	std::vector<uint64_t> bits;
+	std::vector<size_t> set;
+};
+
+#endif